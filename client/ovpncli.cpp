@@ -105,7 +105,6 @@ namespace openvpn {
       MySessionStats(OpenVPNClient* parent_arg)
 	: parent(parent_arg)
       {
-	std::memset(errors, 0, sizeof(errors));
 #ifdef OPENVPN_DEBUG_VERBOSE_ERRORS
 	session_stats_set_verbose(true);
 #endif
@@ -136,20 +135,22 @@ namespace openvpn {
 	    if (index < N_STATS)
 	      return get_stat(index);
 	    else
-	      return errors[index - N_STATS];
+	      return get_error(index - N_STATS);
 	  }
 	else
 	  return 0;
       }
 
-      count_t stat_count(const size_t index) const
+      // stats followed by errors, in the order of combined_name
+      void combined_snapshot(std::vector<long long>& sv) const
       {
-	return get_stat_fast(index);
-      }
-
-      count_t error_count(const size_t index) const
-      {
-	return errors[index];
+	Snapshot snap;
+	snapshot(snap);
+	sv.reserve(sv.size() + combined_n());
+	for (size_t i = 0; i < N_STATS; ++i)
+	  sv.push_back(snap.stats[i]);
+	for (size_t i = 0; i < Error::N_ERRORS; ++i)
+	  sv.push_back(snap.errors[i]);
       }
 
       void detach_from_parent()
@@ -167,13 +168,12 @@ namespace openvpn {
 	    else
 	      OPENVPN_LOG("ERROR: " << Error::name(err));
 #endif
-	    ++errors[err];
+	    count_error(err);
 	  }
       }
 
     private:
       OpenVPNClient* parent;
-      count_t errors[Error::N_ERRORS];
     };
 
     class MyClientEvents : public ClientEvent::Queue
@@ -293,7 +293,8 @@ namespace openvpn {
       {
 	ClientState() : conn_timeout(0), tun_persist(false),
 			google_dns_fallback(false), disable_client_cert(false),
-			default_key_direction(-1) {}
+			default_key_direction(-1), data_pipeline_workers(0), tun_queues(0),
+			tun_burst_size(0), udp_batch_size(0), timer_wheel(false) {}
 
 	OptionList options;
 	EvalConfig eval;
@@ -314,6 +315,11 @@ namespace openvpn {
 	std::string external_pki_alias;
 	bool disable_client_cert;
 	int default_key_direction;
+	int data_pipeline_workers;
+	int tun_queues;
+	int tun_burst_size;
+	int udp_batch_size;
+	bool timer_wheel;
 	ProtoContextOptions::Ptr proto_context_options;
 	HTTPProxyTransport::Options::Ptr http_proxy_options;
       };
@@ -399,6 +405,11 @@ namespace openvpn {
 	  state->external_pki_alias = config.externalPkiAlias;
 	state->disable_client_cert = config.disableClientCert;
 	state->default_key_direction = config.defaultKeyDirection;
+	state->data_pipeline_workers = config.dataPipelineWorkers;
+	state->tun_queues = config.tunQueues;
+	state->tun_burst_size = config.tunBurstSize;
+	state->udp_batch_size = config.udpBatchSize;
+	state->timer_wheel = config.timerWheel;
 	if (!config.proxyHost.empty())
 	  {
 	    HTTPProxyTransport::Options::Ptr ho(new HTTPProxyTransport::Options());
@@ -584,6 +595,11 @@ namespace openvpn {
 	cc.private_key_password = state->private_key_password;
 	cc.disable_client_cert = state->disable_client_cert;
 	cc.default_key_direction = state->default_key_direction;
+	cc.data_pipeline_workers = state->data_pipeline_workers;
+	cc.tun_queues = state->tun_queues;
+	cc.tun_burst_size = state->tun_burst_size;
+	cc.udp_batch_size = state->udp_batch_size;
+	cc.timer_wheel = state->timer_wheel;
 #if defined(USE_TUN_BUILDER)
 	cc.socket_protect = &state->socket_protect;
 	cc.builder = this;
@@ -759,10 +775,10 @@ namespace openvpn {
     {
       std::vector<long long> sv;
       MySessionStats::Ptr stats = state->stats;
-      const size_t n = MySessionStats::combined_n();
-      sv.reserve(n);
-      for (size_t i = 0; i < n; ++i)
-	sv.push_back(stats ? stats->combined_value(i) : 0);
+      if (stats)
+	stats->combined_snapshot(sv);
+      else
+	sv.resize(MySessionStats::combined_n(), 0);
       return sv;
     }
 
@@ -777,12 +793,14 @@ namespace openvpn {
       // data.  Vice versa for TUN_*_IN.
       if (stats)
 	{
-	  ret.bytesOut = stats->stat_count(SessionStats::TUN_BYTES_IN);
-	  ret.bytesIn = stats->stat_count(SessionStats::TUN_BYTES_OUT);
-	  ret.packetsOut = stats->stat_count(SessionStats::TUN_PACKETS_IN);
-	  ret.packetsIn = stats->stat_count(SessionStats::TUN_PACKETS_OUT);
-	  ret.errorsOut = stats->error_count(Error::TUN_READ_ERROR);
-	  ret.errorsIn = stats->error_count(Error::TUN_WRITE_ERROR);
+	  SessionStats::Snapshot snap;
+	  stats->snapshot(snap);
+	  ret.bytesOut = snap.stats[SessionStats::TUN_BYTES_IN];
+	  ret.bytesIn = snap.stats[SessionStats::TUN_BYTES_OUT];
+	  ret.packetsOut = snap.stats[SessionStats::TUN_PACKETS_IN];
+	  ret.packetsIn = snap.stats[SessionStats::TUN_PACKETS_OUT];
+	  ret.errorsOut = snap.errors[Error::TUN_READ_ERROR];
+	  ret.errorsIn = snap.errors[Error::TUN_WRITE_ERROR];
 	}
       else
 	{
@@ -804,10 +822,12 @@ namespace openvpn {
       ret.lastPacketReceived = -1; // undefined
       if (stats)
 	{
-	  ret.bytesOut = stats->stat_count(SessionStats::BYTES_OUT);
-	  ret.bytesIn = stats->stat_count(SessionStats::BYTES_IN);
-	  ret.packetsOut = stats->stat_count(SessionStats::PACKETS_OUT);
-	  ret.packetsIn = stats->stat_count(SessionStats::PACKETS_IN);
+	  SessionStats::Snapshot snap;
+	  stats->snapshot(snap);
+	  ret.bytesOut = snap.stats[SessionStats::BYTES_OUT];
+	  ret.bytesIn = snap.stats[SessionStats::BYTES_IN];
+	  ret.packetsOut = snap.stats[SessionStats::PACKETS_OUT];
+	  ret.packetsIn = snap.stats[SessionStats::PACKETS_IN];
 
 	  // calculate time since last packet received
 	  {
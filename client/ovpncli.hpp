@@ -146,7 +146,8 @@ namespace openvpn {
     {
       Config() : connTimeout(0), tunPersist(false), googleDnsFallback(false),
 		 disableClientCert(false), defaultKeyDirection(-1),
-		 proxyAllowCleartextAuth(false) {}
+		 dataPipelineWorkers(0), tunQueues(0), tunBurstSize(0),
+		 udpBatchSize(0), timerWheel(false), proxyAllowCleartextAuth(false) {}
 
       // OpenVPN profile as a string
       std::string content;
@@ -196,6 +197,31 @@ namespace openvpn {
       // for compatibility with 2.x branch
       int defaultKeyDirection;
 
+      // Number of worker threads for data channel encryption,
+      // decryption and compression on UDP connections, or 0 (default)
+      // to do this work on the thread that calls connect().
+      int dataPipelineWorkers;
+
+      // Number of queues for the tun device on Linux, each beyond the
+      // first read by its own thread, or 0 (default) for a single queue.
+      // Works best together with dataPipelineWorkers.
+      int tunQueues;
+
+      // Read the tun device on Linux in bursts of up to this many
+      // packets and encrypt each burst as a batch, or 0 (default) to
+      // read one packet at a time.
+      int tunBurstSize;
+
+      // Receive and send UDP packets on Linux in batches of up to this
+      // many with recvmmsg/sendmmsg, or 0 (default) for one system
+      // call per packet.
+      int udpBatchSize;
+
+      // If true, keep the protocol deadlines of the session on a single
+      // timing wheel driven by one timer, rather than polling them from
+      // a housekeeping timer (default).
+      bool timerWheel;
+
       // HTTP Proxy parameters (optional)
       std::string proxyHost;         // hostname or IP address of proxy
       std::string proxyPort;         // port number of proxy
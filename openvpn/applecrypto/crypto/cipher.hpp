@@ -149,6 +149,9 @@ namespace openvpn {
 
       bool defined() const { return cipher_ != NULL; }
 
+      // CommonCrypto has no public AEAD interface
+      bool is_aead() const { return false; }
+
     private:
       const CipherInfo *get() const
       {
@@ -182,7 +185,9 @@ namespace openvpn {
 
       enum {
 	MAX_IV_LENGTH = 16,
-	CIPH_CBC_MODE = 0
+	CIPH_CBC_MODE = 0,
+	AEAD_TAG_LENGTH = 16,
+	SUPPORTS_AEAD = 0
       };
 
       CipherContext()
@@ -280,6 +285,26 @@ namespace openvpn {
 	return CIPH_CBC_MODE;
       }
 
+      bool is_aead() const { return false; }
+
+      // AEAD is not available through the public CommonCrypto API,
+      // so these are never reached (is_aead() is always false).
+      bool aead_encrypt(const unsigned char *iv,
+			unsigned char *out, const unsigned char *in, const size_t length,
+			const unsigned char *ad, const size_t ad_len,
+			unsigned char *tag)
+      {
+	return false;
+      }
+
+      bool aead_decrypt(const unsigned char *iv,
+			unsigned char *out, const unsigned char *in, const size_t length,
+			const unsigned char *ad, const size_t ad_len,
+			const unsigned char *tag)
+      {
+	return false;
+      }
+
     private:
       void erase()
       {
@@ -64,27 +64,29 @@ namespace openvpn {
 
       ~HMACContext()
       {
-	dealloc();
+	erase();
       }
 
       void init(const Digest& digest, const unsigned char *key, const size_t key_size)
       {
-	clear();
-	dealloc();
+	erase();
 	info = digest.get();
 	alg = info->hmac_alg();
 	if (key_size > MAX_HMAC_KEY_SIZE)
 	  throw hmac_keysize_error();
-	std::memcpy(key_, key, key_size_ = key_size);
-	CCHmacInit(&ctx, alg, key_, key_size_);
+	CCHmacInit(&ctx_init, alg, key, key_size);
+	ctx = ctx_init;
 	initialized = need_to_dealloc = true;
       }
 
-      void reset() // Apple HMAC API is missing reset method, so we have to reinit
+      // Apple HMAC API is missing reset method, so we start over from a
+      // copy of the context as it was after CCHmacInit, which already
+      // holds the inner and outer states keyed with ipad and opad
+      void reset()
       {
 	check_initialized();
 	dealloc();
-	CCHmacInit(&ctx, alg, key_, key_size_);
+	ctx = ctx_init;
 	need_to_dealloc = true;
       }
 
@@ -125,6 +127,16 @@ namespace openvpn {
 	  }
       }
 
+      void erase()
+      {
+	dealloc();
+	if (initialized)
+	  {
+	    std::memset(&ctx_init, 0, sizeof(ctx_init));
+	    initialized = false;
+	  }
+      }
+
       void check_initialized() const
       {
 #ifdef OPENVPN_ENABLE_ASSERT
@@ -137,8 +149,7 @@ namespace openvpn {
       bool need_to_dealloc;
       const DigestInfo *info;
       CCHmacAlgorithm alg;
-      size_t key_size_;
-      unsigned char key_[MAX_HMAC_KEY_SIZE];
+      CCHmacContext ctx_init; // context keyed by init, copied by reset
       CCHmacContext ctx;
     };
   }
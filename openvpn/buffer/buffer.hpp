@@ -63,6 +63,11 @@
 #include <openvpn/common/exception.hpp>
 #include <openvpn/common/rc.hpp>
 
+#ifdef OPENVPN_BUFFER_SLAB
+#include <boost/type_traits/is_pod.hpp>
+#include <openvpn/buffer/slab.hpp>
+#endif
+
 #ifdef OPENVPN_BUFFER_ABORT
 #define OPENVPN_BUFFER_THROW(exc) { abort(); }
 #else
@@ -439,7 +444,7 @@ namespace openvpn {
       capacity_ = capacity;
       if (capacity)
 	{
-	  data_ = new T[capacity];
+	  data_ = new_(capacity);
 	  if (flags & CONSTRUCT_ZERO)
 	    std::memset(data_, 0, capacity * sizeof(T));
 	  if (flags & ARRAY)
@@ -453,7 +458,7 @@ namespace openvpn {
       size_ = capacity_ = size;
       if (size)
 	{
-	  data_ = new T[size];
+	  data_ = new_(size);
 	  std::memcpy(data_, data, size * sizeof(T));
 	}
     }
@@ -466,7 +471,7 @@ namespace openvpn {
       flags_ = other.flags_;
       if (capacity_)
         {
-          data_ = new T[capacity_];
+          data_ = new_(capacity_);
           if (size_)
             std::memcpy(data_ + offset_, other.data_ + offset_, size_ * sizeof(T));
         }
@@ -482,7 +487,7 @@ namespace openvpn {
       flags_ = flags;
       if (capacity_)
 	{
-	  data_ = new T[capacity_];
+	  data_ = new_(capacity_);
 	  if (size_)
 	    std::memcpy(data_ + offset_, other.c_data(), size_ * sizeof(T));
 	}
@@ -497,7 +502,7 @@ namespace openvpn {
 	    {
 	      erase_();
 	      if (other.capacity_)
-		data_ = new T[other.capacity_];
+		data_ = new_(other.capacity_);
 	      capacity_ = other.capacity_;
 	    }
 	  offset_ = other.offset_;
@@ -517,7 +522,7 @@ namespace openvpn {
 	  erase_();
 	  if (capacity)
 	    {
-	      data_ = new T[capacity];
+	      data_ = new_(capacity);
 	    }
 	  capacity_ = capacity;
 	}
@@ -535,7 +540,7 @@ namespace openvpn {
 	{
 	  erase_();
 	  if (size)
-	    data_ = new T[size];
+	    data_ = new_(size);
 	  capacity_ = size;
 	}
       size_ = size;
@@ -610,7 +615,7 @@ namespace openvpn {
 	{
 	  if (flags_ & GROW)
 	    {
-	      T* data = new T[newcap];
+	      T* data = new_(newcap);
 	      if (size_)
 		std::memcpy(data + offset_, data_ + offset_, size_ * sizeof(T));
 	      delete_(data_, capacity_, flags_);
@@ -635,10 +640,31 @@ namespace openvpn {
       capacity_ = 0;
     }
 
+    // Storage whose size matches a BufferSlab class comes from the slab.
+    // Since classes are never removed, delete_ can make the same decision
+    // from the size alone.  A heap array of a class size that was allocated
+    // before its class was registered is simply adopted by the slab.
+    static T* new_(const size_t size)
+    {
+#ifdef OPENVPN_BUFFER_SLAB
+      if (boost::is_pod<T>::value)
+	{
+	  void* block = BufferSlab::alloc(size * sizeof(T));
+	  if (block)
+	    return static_cast<T*>(block);
+	}
+#endif
+      return new T[size];
+    }
+
     static void delete_(T* data, const size_t size, const unsigned int flags)
     {
       if (size && (flags & DESTRUCT_ZERO))
 	std::memset(data, 0, size * sizeof(T));
+#ifdef OPENVPN_BUFFER_SLAB
+      if (boost::is_pod<T>::value && BufferSlab::free(data, size * sizeof(T)))
+	return;
+#endif
       delete [] data;
     }
 
@@ -0,0 +1,337 @@
+//    OpenVPN -- An application to securely tunnel IP networks
+//               over a single port, with support for SSL/TLS-based
+//               session authentication and key exchange,
+//               packet encryption, packet authentication, and
+//               packet compression.
+//
+//    Copyright (C) 2013 OpenVPN Technologies, Inc.
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Affero General Public License Version 3
+//    as published by the Free Software Foundation.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Affero General Public License for more details.
+//
+//    You should have received a copy of the GNU Affero General Public License
+//    along with this program in the COPYING file.
+//    If not, see <http://www.gnu.org/licenses/>.
+
+// Slab allocator for BufferAllocated storage, used when OPENVPN_BUFFER_SLAB
+// is defined.
+//
+// Each capacity registered with add_class (normally the standardized
+// capacities of a Frame) becomes a size class, and allocations of exactly
+// that many bytes are served from per-thread free lists that need no
+// locking.  A thread whose free list grows past CACHE_MAX blocks, such as
+// the consuming end of a handoff between threads, passes a batch back to
+// a shared depot, and a thread whose free list is empty takes a batch
+// from the depot, so the depot lock is only taken once per BATCH blocks.
+// Blocks are carved from chunks that are never returned to the system,
+// optionally backed by huge pages.  Sizes that don't match a class are
+// left to the heap.
+
+#ifndef OPENVPN_BUFFER_SLAB_H
+#define OPENVPN_BUFFER_SLAB_H
+
+#include <cstddef>
+
+#include <boost/atomic.hpp>
+
+#include <openvpn/common/types.hpp>
+#include <openvpn/common/platform.hpp>
+#include <openvpn/common/thread.hpp>
+
+#if OPENVPN_MULTITHREAD
+#include <boost/thread/tss.hpp>
+#endif
+
+#ifdef OPENVPN_PLATFORM_LINUX
+#include <sys/mman.h>
+#endif
+
+namespace openvpn {
+
+  class BufferSlab
+  {
+  public:
+    enum {
+      MAX_CLASSES = 8,
+      BLOCK_ALIGN = 64,  // blocks start on a cache line boundary
+      CHUNK_BLOCKS = 64, // blocks per chunk, unless huge pages make it larger
+      CACHE_MAX = 256,   // max free blocks per thread and class
+      BATCH = 32,        // blocks moved between a thread and the depot at a time
+    };
+
+    struct Stats
+    {
+      size_t classes;        // registered size classes
+      size_t chunks;         // chunks carved into blocks
+      size_t huge_chunks;    // chunks backed by huge pages
+      size_t bytes_reserved; // total size of chunks
+      size_t refills;        // batches taken from the depot
+      size_t spills;         // batches returned to the depot
+    };
+
+    // Serve allocations of exactly capacity bytes from the slab.
+    // Registering a capacity again is a no-op, and classes are never
+    // removed, so a block always goes back to the allocator it came from.
+    static void add_class(const size_t capacity)
+    {
+      Global& g = global();
+      Mutex::scoped_lock lock(g.mutex);
+      const size_t n = g.n_classes.load(boost::memory_order_relaxed);
+      if (capacity < sizeof(Block) || n >= MAX_CLASSES)
+	return;
+      for (size_t i = 0; i < n; ++i)
+	if (g.classes[i].size == capacity)
+	  return;
+      g.classes[n].size = capacity;
+      g.classes[n].stride = (capacity + BLOCK_ALIGN - 1) & ~size_t(BLOCK_ALIGN - 1);
+      g.n_classes.store(n + 1, boost::memory_order_release);
+    }
+
+    // back new chunks with huge pages where the platform supports it
+    static void use_huge_pages(const bool enable)
+    {
+      global().huge_pages.store(enable, boost::memory_order_relaxed);
+    }
+
+    // Return a block of size bytes, or NULL if size isn't a slab class.
+    static void* alloc(const size_t size)
+    {
+      Global& g = global();
+      const int c = find_class(g, size);
+      if (c < 0)
+	return NULL;
+      FreeList& fl = thread_cache(g).lists[c];
+      if (!fl.head)
+	refill(g, g.classes[c], fl);
+      return fl.pop();
+    }
+
+    // Take back a block of size bytes, returning false if size isn't
+    // a slab class, in which case the block came from the heap.
+    static bool free(void* block, const size_t size)
+    {
+      Global& g = global();
+      const int c = find_class(g, size);
+      if (c < 0)
+	return false;
+      FreeList& fl = thread_cache(g).lists[c];
+      fl.push(static_cast<Block*>(block));
+      if (fl.count > CACHE_MAX)
+	spill(g, g.classes[c], fl, BATCH);
+      return true;
+    }
+
+    static Stats stats()
+    {
+      const Global& g = global();
+      Stats s;
+      s.classes = g.n_classes.load(boost::memory_order_acquire);
+      s.chunks = g.chunks.load(boost::memory_order_relaxed);
+      s.huge_chunks = g.huge_chunks.load(boost::memory_order_relaxed);
+      s.bytes_reserved = g.bytes_reserved.load(boost::memory_order_relaxed);
+      s.refills = g.refills.load(boost::memory_order_relaxed);
+      s.spills = g.spills.load(boost::memory_order_relaxed);
+      return s;
+    }
+
+  private:
+    struct Block
+    {
+      Block* next;
+    };
+
+    struct FreeList
+    {
+      FreeList() : head(NULL), count(0) {}
+
+      void push(Block* b)
+      {
+	b->next = head;
+	head = b;
+	++count;
+      }
+
+      Block* pop()
+      {
+	Block* b = head;
+	if (b)
+	  {
+	    head = b->next;
+	    --count;
+	  }
+	return b;
+      }
+
+      Block* head;
+      size_t count;
+    };
+
+    struct Class
+    {
+      Class() : size(0), stride(0) {}
+
+      size_t size;
+      size_t stride;
+      Mutex mutex;    // protects depot
+      FreeList depot;
+    };
+
+    struct ThreadCache
+    {
+      // give the blocks of an exiting thread to the depot
+      ~ThreadCache()
+      {
+	Global& g = global();
+	const size_t n = g.n_classes.load(boost::memory_order_acquire);
+	for (size_t i = 0; i < n; ++i)
+	  spill(g, g.classes[i], lists[i], lists[i].count);
+      }
+
+      FreeList lists[MAX_CLASSES];
+    };
+
+    struct Global
+    {
+      Global()
+	: n_classes(0),
+	  huge_pages(false),
+	  chunks(0),
+	  huge_chunks(0),
+	  bytes_reserved(0),
+	  refills(0),
+	  spills(0)
+      {
+      }
+
+      Class classes[MAX_CLASSES];
+      boost::atomic<size_t> n_classes;
+      boost::atomic<bool> huge_pages;
+      Mutex mutex; // serializes add_class
+
+      boost::atomic<size_t> chunks;
+      boost::atomic<size_t> huge_chunks;
+      boost::atomic<size_t> bytes_reserved;
+      boost::atomic<size_t> refills;
+      boost::atomic<size_t> spills;
+
+#if OPENVPN_MULTITHREAD
+      boost::thread_specific_ptr<ThreadCache> cache;
+#else
+      ThreadCache cache;
+#endif
+    };
+
+    // never destroyed, since buffers may be freed by static destructors
+    static Global& global()
+    {
+      static Global* g = new Global();
+      return *g;
+    }
+
+    static ThreadCache& thread_cache(Global& g)
+    {
+#if OPENVPN_MULTITHREAD
+      ThreadCache* tc = g.cache.get();
+      if (!tc)
+	{
+	  tc = new ThreadCache();
+	  g.cache.reset(tc);
+	}
+      return *tc;
+#else
+      return g.cache;
+#endif
+    }
+
+    static int find_class(const Global& g, const size_t size)
+    {
+      const size_t n = g.n_classes.load(boost::memory_order_acquire);
+      for (size_t i = 0; i < n; ++i)
+	if (g.classes[i].size == size)
+	  return int(i);
+      return -1;
+    }
+
+    // move up to n blocks from fl to the depot
+    static void spill(Global& g, Class& cl, FreeList& fl, size_t n)
+    {
+      if (!n || !fl.head)
+	return;
+      FreeList batch;
+      while (n-- && fl.head)
+	batch.push(fl.pop());
+      Mutex::scoped_lock lock(cl.mutex);
+      while (batch.head)
+	cl.depot.push(batch.pop());
+      g.spills.fetch_add(1, boost::memory_order_relaxed);
+    }
+
+    // move a batch of blocks from the depot to fl, carving a new
+    // chunk if the depot is empty
+    static void refill(Global& g, Class& cl, FreeList& fl)
+    {
+      {
+	Mutex::scoped_lock lock(cl.mutex);
+	for (size_t i = 0; i < BATCH && cl.depot.head; ++i)
+	  fl.push(cl.depot.pop());
+      }
+      if (fl.head)
+	g.refills.fetch_add(1, boost::memory_order_relaxed);
+      else
+	carve(g, cl, fl);
+    }
+
+    static void carve(Global& g, Class& cl, FreeList& fl)
+    {
+      size_t bytes = cl.stride * CHUNK_BLOCKS;
+      unsigned char* chunk = NULL;
+      bool huge = false;
+
+#if defined(OPENVPN_PLATFORM_LINUX) && defined(MAP_HUGETLB)
+      if (g.huge_pages.load(boost::memory_order_relaxed))
+	{
+	  const size_t huge_page_size = 2 * 1024 * 1024;
+	  bytes = (bytes + huge_page_size - 1) & ~(huge_page_size - 1);
+	  void* p = ::mmap(NULL, bytes, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS|MAP_HUGETLB, -1, 0);
+	  if (p != MAP_FAILED)
+	    huge = true;
+	  else
+	    {
+	      // no reserved huge pages, ask for transparent ones instead
+	      p = ::mmap(NULL, bytes, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+#ifdef MADV_HUGEPAGE
+	      if (p != MAP_FAILED)
+		huge = (::madvise(p, bytes, MADV_HUGEPAGE) == 0);
+#endif
+	    }
+	  if (p != MAP_FAILED)
+	    chunk = static_cast<unsigned char*>(p);
+	}
+#endif
+
+      if (!chunk)
+	{
+	  // align the first block by hand
+	  unsigned char* raw = new unsigned char[bytes + BLOCK_ALIGN];
+	  chunk = raw + (-size_t(raw) & (BLOCK_ALIGN - 1));
+	}
+
+      for (size_t off = 0; off + cl.stride <= bytes; off += cl.stride)
+	fl.push(reinterpret_cast<Block*>(chunk + off));
+
+      g.chunks.fetch_add(1, boost::memory_order_relaxed);
+      if (huge)
+	g.huge_chunks.fetch_add(1, boost::memory_order_relaxed);
+      g.bytes_reserved.fetch_add(bytes, boost::memory_order_relaxed);
+    }
+  };
+
+} // namespace openvpn
+
+#endif // OPENVPN_BUFFER_SLAB_H
@@ -52,6 +52,7 @@
 #include <openvpn/common/rc.hpp>
 #include <openvpn/common/scoped_ptr.hpp>
 #include <openvpn/time/asiotimer.hpp>
+#include <openvpn/time/asiotimewheel.hpp>
 #include <openvpn/client/cliopt.hpp>
 #include <openvpn/client/remotelist.hpp>
 
@@ -84,6 +85,8 @@ namespace openvpn {
 	conn_timer(io_service_arg),
 	conn_timer_pending(false)
     {
+      if (client_options_arg->timer_wheel())
+	timer_wheel.reset(new AsioTimingWheel(io_service_arg));
     }
 
     void start()
@@ -123,6 +126,8 @@ namespace openvpn {
 	  if (client)
 	    client->stop(false);
 	  cancel_timers();
+	  if (timer_wheel)
+	    timer_wheel->stop();
 	  asio_work.reset();
 
 	  ClientEvent::Base::Ptr ev = new ClientEvent::Disconnected();
@@ -420,7 +425,8 @@ namespace openvpn {
 	    client_options->next();
 	}
       Client::Config::Ptr cli_config = client_options->client_config();
-      client.reset(new Client(io_service, *cli_config, this));
+      cli_config->proto_context_config->timer_wheel = timer_wheel; // shared by successive sessions
+      client.reset(client_options->new_session(io_service, *cli_config, this));
 
       restart_wait_timer.cancel();
       if (client_options->server_poll_timeout_enabled())
@@ -439,13 +445,14 @@ namespace openvpn {
     int conn_timeout;
     boost::asio::io_service& io_service;
     ClientOptions::Ptr client_options;
-    Client::Ptr client;
+    ClientProto::SessionBase::Ptr client;
     AsioTimer server_poll_timer;
     AsioTimer restart_wait_timer;
     AsioTimer conn_timer;
     bool conn_timer_pending;
     ScopedPtr<boost::asio::io_service::work> asio_work;
     RemoteList::PreResolve::Ptr pre_resolve;
+    AsioTimingWheel::Ptr timer_wheel; // protocol deadlines of client sessions, if enabled
   };
 
 }
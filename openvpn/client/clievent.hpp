@@ -49,6 +49,7 @@ namespace openvpn {
       ADD_ROUTES,
       PAUSE,
       RESUME,
+      CONNECT_TIMING,
 
       // start of errors, must be marked by ERROR_START below
       AUTH_FAILED,
@@ -88,6 +89,7 @@ namespace openvpn {
 	"ADD_ROUTES",
 	"PAUSE",
 	"RESUME",
+	"CONNECT_TIMING",
 	"AUTH_FAILED",
 	"CERT_VERIFY_FAIL",
 	"TLS_VERSION_MIN",
@@ -201,6 +203,38 @@ namespace openvpn {
       Resume() : Base(RESUME) {}
     };
 
+    // Time taken by each phase of a connect, in milliseconds from when
+    // the transport started the OpenVPN handshake
+    struct ConnectTiming : public Base
+    {
+      typedef boost::intrusive_ptr<ConnectTiming> Ptr;
+
+      ConnectTiming()
+	: Base(CONNECT_TIMING),
+	  rtt_ms(0),
+	  active_ms(0),
+	  push_reply_ms(0),
+	  connected_ms(0),
+	  push_requests(0)
+      {
+      }
+
+      unsigned int rtt_ms;        // first round trip of the control channel
+      unsigned int active_ms;     // TLS session ACTIVE
+      unsigned int push_reply_ms; // complete PUSH_REPLY received
+      unsigned int connected_ms;  // tun up
+      unsigned int push_requests; // PUSH_REQUEST messages sent
+
+      virtual std::string render() const
+      {
+	std::ostringstream out;
+	out << "rtt=" << rtt_ms << "ms active=" << active_ms
+	    << "ms push_reply=" << push_reply_ms << "ms connected=" << connected_ms
+	    << "ms push_requests=" << push_requests;
+	return out.str();
+      }
+    };
+
     struct Disconnected : public Base
     {
       Disconnected() : Base(DISCONNECTED) {}
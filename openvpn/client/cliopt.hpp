@@ -110,6 +110,11 @@ namespace openvpn {
 #endif
     typedef ClientProto::Session<RandomAPI, ClientCryptoAPI, ClientSSLAPI> Client;
 
+    // constructs a Session variant, chosen by load_transport_config
+    typedef ClientProto::SessionBase* (*SessionFactory)(boost::asio::io_service& io_service,
+							const Client::Config& config,
+							ClientProto::NotifyCallback* notify_callback);
+
     struct Config {
       Config()
       {
@@ -121,6 +126,11 @@ namespace openvpn {
 	google_dns_fallback = false;
 	disable_client_cert = false;
 	default_key_direction = -1;
+	data_pipeline_workers = 0;
+	tun_queues = 0;
+	tun_burst_size = 0;
+	udp_batch_size = 0;
+	timer_wheel = false;
 #if defined(USE_TUN_BUILDER)
 	builder = NULL;
 #endif
@@ -138,6 +148,11 @@ namespace openvpn {
       std::string private_key_password;
       bool disable_client_cert;
       int default_key_direction;
+      int data_pipeline_workers;
+      int tun_queues;
+      int tun_burst_size;
+      int udp_batch_size;
+      bool timer_wheel;
 
       // callbacks -- must remain in scope for lifetime of ClientOptions object
       ExternalPKIBase* external_pki;
@@ -150,7 +165,8 @@ namespace openvpn {
 
     ClientOptions(const OptionList& opt,   // only needs to remain in scope for duration of constructor call
 		  const Config& config)
-      : socket_protect(config.socket_protect),
+      : session_factory(NULL),
+	socket_protect(config.socket_protect),
 	reconnect_notify(config.reconnect_notify),
 	cli_stats(config.cli_stats),
 	cli_events(config.cli_events),
@@ -158,6 +174,8 @@ namespace openvpn {
 	server_override(config.server_override),
 	proto_override(config.proto_override),
 	conn_timeout_(config.conn_timeout),
+	udp_batch_size_(config.udp_batch_size),
+	timer_wheel_(config.timer_wheel),
 	proto_context_options(config.proto_context_options),
 	http_proxy_options(config.http_proxy_options)
     {
@@ -166,7 +184,7 @@ namespace openvpn {
 
       // initialize RNG/PRNG
       rng.reset(new RandomAPI());
-      prng.reset(new PRNG<RandomAPI, ClientCryptoAPI>("SHA1", rng, 16));
+      prng.reset(new PRNG<RandomAPI, ClientCryptoAPI>(ClientCryptoAPI::Cipher("AES-128-CBC"), rng));
 
       // frame
       frame = frame_init();
@@ -198,9 +216,12 @@ namespace openvpn {
       cp->set_autologin(pcc.autologin());
       cp->ssl_ctx.reset(new ClientSSLAPI(cc));
       cp->frame = frame;
+      cp->plan_frame();
       cp->now = &now_;
       cp->rng = rng;
       cp->prng = prng;
+      if (config.data_pipeline_workers > 0)
+	cp->data_pipeline_workers = config.data_pipeline_workers;
 
       // load remote list
       remote_list.reset(new RemoteList(opt));
@@ -278,6 +299,13 @@ namespace openvpn {
       tunconf->stats = cli_stats;
       if (tun_mtu)
 	tunconf->mtu = tun_mtu;
+      if (config.tun_queues > 1)
+	tunconf->n_queues = config.tun_queues;
+      if (config.tun_burst_size > 0)
+	tunconf->burst_size = config.tun_burst_size;
+#ifdef OPENVPN_TUN_VNET_HDR
+      tunconf->vnet_hdr = true;
+#endif
 #elif defined(OPENVPN_PLATFORM_MAC) && !defined(OPENVPN_FORCE_TUN_NULL)
       TunMac::ClientConfig::Ptr tunconf = TunMac::ClientConfig::new_obj();
       tunconf->layer = cp->layer;
@@ -367,6 +395,13 @@ namespace openvpn {
       return cli_config;
     }
 
+    ClientProto::SessionBase* new_session(boost::asio::io_service& io_service,
+					  const Client::Config& config,
+					  ClientProto::NotifyCallback* notify_callback) const
+    {
+      return session_factory(io_service, config, notify_callback);
+    }
+
     bool need_creds() const
     {
       return !cp->autologin;
@@ -400,6 +435,7 @@ namespace openvpn {
     const RemoteList::Ptr& remote_list_ptr() const { return remote_list; }
 
     int conn_timeout() const { return conn_timeout_; }
+    bool timer_wheel() const { return timer_wheel_; }
 
     void update_now()
     {
@@ -407,6 +443,26 @@ namespace openvpn {
     }
 
   private:
+    template <typename DATA_PATH>
+    static ClientProto::SessionBase* new_session_obj(boost::asio::io_service& io_service,
+						     const Client::Config& config,
+						     ClientProto::NotifyCallback* notify_callback)
+    {
+      return new ClientProto::Session<RandomAPI, ClientCryptoAPI, ClientSSLAPI, DATA_PATH>(io_service, config, notify_callback);
+    }
+
+    // Session whose data path calls the given transport and the tun
+    // directly, for tun implementations whose client class is known here.
+    template <typename TRANSPORT>
+    static SessionFactory direct_session_factory()
+    {
+#if defined(OPENVPN_PLATFORM_LINUX) && !defined(USE_TUN_BUILDER) && !defined(OPENVPN_FORCE_TUN_NULL)
+      return &new_session_obj<ClientProto::DirectDataPath<TRANSPORT, TunLinux::Client> >;
+#else
+      return &new_session_obj<ClientProto::VirtualDataPath>;
+#endif
+    }
+
     std::string load_transport_config()
     {
       // get current transport protocol
@@ -432,6 +488,7 @@ namespace openvpn {
 	  httpconf->http_proxy_options = http_proxy_options;
 	  httpconf->rng = rng;
 	  transport_factory = httpconf;
+	  session_factory = &new_session_obj<ClientProto::VirtualDataPath>;
 	}
       else
 	{
@@ -443,7 +500,17 @@ namespace openvpn {
 	      udpconf->frame = frame;
 	      udpconf->stats = cli_stats;
 	      udpconf->socket_protect = socket_protect;
+#ifdef OPENVPN_UDPLINK_MMSG
+	      if (udp_batch_size_ > 0)
+		{
+		  udpconf->batch_size = udp_batch_size_;
+#ifdef OPENVPN_UDP_OFFLOAD
+		  udpconf->offload = UDPTransport::OFFLOAD_GSO|UDPTransport::OFFLOAD_GRO;
+#endif
+		}
+#endif
 	      transport_factory = udpconf;
+	      session_factory = direct_session_factory<UDPTransport::Client>();
 	    }
 	  else if (transport_protocol.is_tcp())
 	    {
@@ -454,6 +521,7 @@ namespace openvpn {
 	      tcpconf->stats = cli_stats;
 	      tcpconf->socket_protect = socket_protect;
 	      transport_factory = tcpconf;
+	      session_factory = direct_session_factory<TCPTransport::Client>();
 	    }
 	  else
 	    throw option_error("internal error: unknown transport protocol");
@@ -471,6 +539,7 @@ namespace openvpn {
     RemoteList::Ptr remote_list_proxy;
     TransportClientFactory::Ptr transport_factory;
     TunClientFactory::Ptr tun_factory;
+    SessionFactory session_factory;
     SocketProtect* socket_protect;
     ReconnectNotify* reconnect_notify;
     SessionStats::Ptr cli_stats;
@@ -480,6 +549,8 @@ namespace openvpn {
     std::string server_override;
     Protocol proto_override;
     int conn_timeout_;
+    int udp_batch_size_;
+    bool timer_wheel_;
     ProtoContextOptions::Ptr proto_context_options;
     HTTPProxyTransport::Options::Ptr http_proxy_options;
     std::string userlocked_username;
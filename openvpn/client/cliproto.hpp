@@ -45,6 +45,7 @@
 #include <boost/algorithm/string.hpp> // for boost::algorithm::starts_with and trim_left_copy
 
 #include <openvpn/common/rc.hpp>
+#include <openvpn/common/workpool.hpp>
 #include <openvpn/tun/client/tunbase.hpp>
 #include <openvpn/transport/client/transbase.hpp>
 #include <openvpn/options/continuation.hpp>
@@ -73,11 +74,107 @@ namespace openvpn {
 			virtual void client_proto_connected() {}
 		};
 
+		// What ClientConnect needs from a session, so that it can hold
+		// any of the Session variants below.
+		class SessionBase
+		{
+		public:
+			typedef boost::intrusive_ptr<SessionBase> Ptr;
+
+			virtual void start() = 0;
+			virtual void stop(const bool call_terminate_callback) = 0;
+			virtual void send_explicit_exit_notify() = 0;
+			virtual bool first_packet_received() const = 0;
+			virtual bool reached_connected_state() const = 0;
+			virtual Error::Type fatal() const = 0;
+			virtual const std::string& fatal_reason() const = 0;
+
+			virtual ~SessionBase() {}
+
+		private:
+			// the reference count lives in the ProtoContext base of Session
+			virtual void session_add_ref() = 0;
+			virtual void session_release() = 0;
+
+			friend void intrusive_ptr_add_ref(SessionBase* p) { p->session_add_ref(); }
+			friend void intrusive_ptr_release(SessionBase* p) { p->session_release(); }
+		};
+
+		// Data path policies, used by Session to hand data channel packets
+		// to the transport and tun layers.  VirtualDataPath works with any
+		// transport and tun, while DirectDataPath names the concrete classes
+		// so that the calls can be resolved, and inlined, at compile time.
+		// DirectDataPath must only be used with factories known to produce
+		// objects of exactly those classes.
+		struct VirtualDataPath
+		{
+			static bool transport_send(TransportClient& transport, BufferAllocated& buf)
+			{
+				return transport.transport_send(buf);
+			}
+
+			static bool tun_send(TunClient& tun, BufferAllocated& buf)
+			{
+				return tun.tun_send(buf);
+			}
+		};
+
+		template <typename TRANSPORT, typename TUN>
+		struct DirectDataPath
+		{
+			static bool transport_send(TransportClient& transport, BufferAllocated& buf)
+			{
+				return static_cast<TRANSPORT&>(transport).TRANSPORT::transport_send(buf);
+			}
+
+			static bool tun_send(TunClient& tun, BufferAllocated& buf)
+			{
+				return static_cast<TUN&>(tun).TUN::tun_send(buf);
+			}
+		};
+
+		// Session configuration, shared by all data path variants
 		template <typename RAND_API, typename CRYPTO_API, typename SSL_API>
-		class Session : public ProtoContext<RAND_API, CRYPTO_API, SSL_API>, TransportClientParent, TunClientParent
+		struct SessionConfig : public RC<thread_unsafe_refcount>
+		{
+			typedef boost::intrusive_ptr<SessionConfig> Ptr;
+			typedef typename ProtoContext<RAND_API, CRYPTO_API, SSL_API>::Config ProtoConfig;
+
+			SessionConfig()
+				: pushed_options_limit("server-pushed options data too large",
+				ProfileParseLimits::MAX_PUSH_SIZE,
+				ProfileParseLimits::OPT_OVERHEAD,
+				ProfileParseLimits::TERM_OVERHEAD,
+				0,
+				ProfileParseLimits::MAX_DIRECTIVE_SIZE)
+			{}
+
+			typename ProtoConfig::Ptr proto_context_config;
+			ProtoContextOptions::Ptr proto_context_options;
+			PushOptionsBase::Ptr push_base;
+			TransportClientFactory::Ptr transport_factory;
+			TunClientFactory::Ptr tun_factory;
+			SessionStats::Ptr cli_stats;
+			ClientEvent::Queue::Ptr cli_events;
+			ClientCreds::Ptr creds;
+			OptionList::Limits pushed_options_limit;
+			OptionList::FilterBase::Ptr pushed_options_filter;
+		};
+
+		template <typename RAND_API, typename CRYPTO_API, typename SSL_API, typename DATA_PATH = VirtualDataPath>
+		class Session : public ProtoContext<RAND_API, CRYPTO_API, SSL_API>, public SessionBase, TransportClientParent, TunClientParent
 		{
 			typedef ProtoContext<RAND_API, CRYPTO_API, SSL_API> Base;
 			typedef typename Base::PacketType PacketType;
+			typedef typename Base::DataJob DataJob;
+			typedef OrderedWorkPool<DataJob, Session> DataPipeline;
+			friend class OrderedWorkPool<DataJob, Session>; // calls work_complete
+
+			enum {
+				DATA_PIPELINE_QUEUE_SIZE = 256, // max data channel packets in flight, must be a power of 2
+				PUSH_REQUEST_MIN_MS = 250,      // bounds of interval between PUSH_REQUEST retries
+				PUSH_REQUEST_MAX_MS = 3000,
+			};
 
 			using Base::now;
 			using Base::stat;
@@ -97,30 +194,7 @@ namespace openvpn {
 
 			OPENVPN_EXCEPTION(proxy_exception);
 
-			struct Config : public RC<thread_unsafe_refcount>
-			{
-				typedef boost::intrusive_ptr<Config> Ptr;
-
-				Config()
-					: pushed_options_limit("server-pushed options data too large",
-					ProfileParseLimits::MAX_PUSH_SIZE,
-					ProfileParseLimits::OPT_OVERHEAD,
-					ProfileParseLimits::TERM_OVERHEAD,
-					0,
-					ProfileParseLimits::MAX_DIRECTIVE_SIZE)
-				{}
-
-				typename ProtoConfig::Ptr proto_context_config;
-				ProtoContextOptions::Ptr proto_context_options;
-				PushOptionsBase::Ptr push_base;
-				TransportClientFactory::Ptr transport_factory;
-				TunClientFactory::Ptr tun_factory;
-				SessionStats::Ptr cli_stats;
-				ClientEvent::Queue::Ptr cli_events;
-				ClientCreds::Ptr creds;
-				OptionList::Limits pushed_options_limit;
-				OptionList::FilterBase::Ptr pushed_options_filter;
-			};
+			typedef SessionConfig<RAND_API, CRYPTO_API, SSL_API> Config;
 
 			Session(boost::asio::io_service& io_service_arg,
 				const Config& config,
@@ -138,6 +212,7 @@ namespace openvpn {
 				proto_context_options(config.proto_context_options),
 				first_packet_received_(false),
 				sent_push_request(false),
+				push_requests(0),
 				cli_stats(config.cli_stats),
 				cli_events(config.cli_events),
 				connected_(false),
@@ -158,9 +233,9 @@ namespace openvpn {
 				//Base::enable_strict_openvpn_2x();
 			}
 
-			bool first_packet_received() const { return first_packet_received_; }
+			virtual bool first_packet_received() const { return first_packet_received_; }
 
-			void start()
+			virtual void start()
 			{
 				if (!halt)
 				{
@@ -169,30 +244,42 @@ namespace openvpn {
 					// coarse wakeup range
 					housekeeping_schedule.init(Time::Duration::binary_ms(512), Time::Duration::binary_ms(1024));
 
+					// start data channel worker threads, if enabled
+					if (Base::data_pipeline())
+						pipeline.reset(new DataPipeline(io_service, this,
+							Base::conf().data_pipeline_workers,
+							DATA_PIPELINE_QUEUE_SIZE));
+
 					// initialize transport-layer packet handler
 					transport = transport_factory->new_client_obj(io_service, *this);
 					transport->start();
 				}
 			}
 
-			void send_explicit_exit_notify()
+			virtual void send_explicit_exit_notify()
 			{
 				if (!halt)
 					Base::send_explicit_exit_notify();
 			}
 
-			void stop(const bool call_terminate_callback)
+			virtual void stop(const bool call_terminate_callback)
 			{
 				if (!halt)
 				{
 					halt = true;
 					housekeeping_timer.cancel();
+					Base::cancel_deadlines();
 					push_request_timer.cancel();
 					inactive_timer.cancel();
+					if (pipeline)
+						pipeline->stop();
 					if (tun)
 						tun->stop();
 					if (transport)
 						transport->stop();
+#ifdef OPENVPN_DEBUG_FRAME
+					OPENVPN_LOG("Frame realigns/copies: " << Frame::realign_count());
+#endif
 					if (notify_callback && call_terminate_callback)
 						notify_callback->client_proto_terminate();
 				}
@@ -203,12 +290,12 @@ namespace openvpn {
 				stop(true);
 			}
 
-			bool reached_connected_state() const { return connected_; }
+			virtual bool reached_connected_state() const { return connected_; }
 
 			// Fatal error means that we shouldn't retry.
 			// Returns a value != Error::UNDEF if error
-			Error::Type fatal() const { return fatal_; }
-			const std::string& fatal_reason() const { return fatal_reason_; }
+			virtual Error::Type fatal() const { return fatal_; }
+			virtual const std::string& fatal_reason() const { return fatal_reason_; }
 
 			virtual ~Session()
 			{
@@ -216,6 +303,9 @@ namespace openvpn {
 			}
 
 		private:
+			virtual void session_add_ref() { intrusive_ptr_add_ref(this); }
+			virtual void session_release() { intrusive_ptr_release(this); }
+
 			// transport obj calls here with incoming packets
 			virtual void transport_recv(BufferAllocated& buf)
 			{
@@ -234,6 +324,10 @@ namespace openvpn {
 						ClientEvent::Base::Ptr ev = new ClientEvent::Connecting();
 						cli_events->add_event(ev);
 						first_packet_received_ = true;
+
+						// reply to our initial reset, so gives a control channel RTT
+						if (connect_start.defined())
+							control_rtt = now() - connect_start;
 					}
 
 					// get packet type
@@ -243,17 +337,31 @@ namespace openvpn {
 					if (pt.is_data())
 					{
 						// data packet
-						Base::data_decrypt(pt, buf);
-						if (buf.size())
+						if (pipeline)
+						{
+							// decrypt on a worker thread, continues in work_complete
+							DataJob* job = pipeline->next_job();
+							if (job) // otherwise pipeline is full, drop packet
+							{
+								job->buf.swap(buf);
+								if (Base::data_pipeline_decrypt(pt, *job))
+									pipeline->submit();
+							}
+						}
+						else
 						{
+							Base::data_decrypt(pt, buf);
+							if (buf.size())
+							{
 #ifdef OPENVPN_PACKET_LOG
-							log_packet(buf, false);
+								log_packet(buf, false);
 #endif
-							// make packet appear as incoming on tun interface
-							if (tun)
-							{
-								OPENVPN_LOG_CLIPROTO("TUN send, size=" << buf.size());
-								tun->tun_send(buf);
+								// make packet appear as incoming on tun interface
+								if (tun)
+								{
+									OPENVPN_LOG_CLIPROTO("TUN send, size=" << buf.size());
+									DATA_PATH::tun_send(*tun, buf);
+								}
 							}
 						}
 
@@ -262,8 +370,11 @@ namespace openvpn {
 					}
 					else if (pt.is_control())
 					{
-						// control packet
-						Base::control_net_recv(pt, buf);
+						// control packet, copied because the control
+						// channel keeps or drops it, and buf may be
+						// a window onto a larger transport buffer
+						BufferPtr bp(new BufferAllocated(buf, 0));
+						Base::control_net_recv(pt, bp);
 
 						// do a full flush
 						Base::flush(true);
@@ -303,13 +414,12 @@ namespace openvpn {
 #ifdef OPENVPN_PACKET_LOG
 					log_packet(buf, true);
 #endif
-					Base::data_encrypt(buf);
-					if (buf.size())
+					if (pipeline)
+						pipeline_encrypt(buf);
+					else
 					{
-						// send packet via transport to destination
-						OPENVPN_LOG_CLIPROTO("Transport SEND " << server_endpoint_render() << ' ' << Base::dump_packet(buf));
-						if (transport->transport_send(buf))
-							Base::update_last_sent();
+						Base::data_encrypt(buf);
+						transport_send_data(buf);
 					}
 
 					// do a lightweight flush
@@ -324,6 +434,99 @@ namespace openvpn {
 				}
 			}
 
+			// tun i/o driver calls here with a burst of incoming packets,
+			// which are encrypted as a batch
+			virtual void tun_recv_burst(BufferAllocated *const *bufs, const size_t n)
+			{
+				try {
+					OPENVPN_LOG_CLIPROTO("TUN recv burst, n=" << n);
+
+					// update current time
+					Base::update_now();
+
+					// encrypt packets
+#ifdef OPENVPN_PACKET_LOG
+					for (size_t i = 0; i < n; ++i)
+						log_packet(*bufs[i], true);
+#endif
+					if (pipeline)
+					{
+						for (size_t i = 0; i < n; ++i)
+							pipeline_encrypt(*bufs[i]);
+					}
+					else
+					{
+						Base::data_encrypt_burst(bufs, n);
+						for (size_t i = 0; i < n; ++i)
+							transport_send_data(*bufs[i]);
+					}
+
+					// do a lightweight flush
+					Base::flush(false);
+
+					// schedule housekeeping wakeup
+					set_housekeeping_timer();
+				}
+				catch (const std::exception& e)
+				{
+					process_exception(e, "tun_recv_burst");
+				}
+			}
+
+			// encrypt on a worker thread, continues in work_complete
+			void pipeline_encrypt(BufferAllocated& buf)
+			{
+				DataJob* job = pipeline->next_job();
+				if (job) // otherwise pipeline is full, drop packet
+				{
+					job->buf.swap(buf);
+					if (Base::data_pipeline_encrypt(*job))
+						pipeline->submit();
+				}
+			}
+
+			// send encrypted data channel packet via transport to destination
+			void transport_send_data(BufferAllocated& buf)
+			{
+				if (buf.size())
+				{
+					OPENVPN_LOG_CLIPROTO("Transport SEND " << server_endpoint_render() << ' ' << Base::dump_packet(buf));
+					if (DATA_PATH::transport_send(*transport, buf))
+						Base::update_last_sent();
+				}
+			}
+
+			// data channel worker threads hand back processed packets here,
+			// in the order they were submitted
+			void work_complete(DataJob& job)
+			{
+				try {
+					Base::update_now();
+					Base::data_pipeline_finish(job);
+					if (job.buf.size())
+					{
+						if (job.encrypt)
+							transport_send_data(job.buf);
+						else
+						{
+#ifdef OPENVPN_PACKET_LOG
+							log_packet(job.buf, false);
+#endif
+							// make packet appear as incoming on tun interface
+							if (tun)
+							{
+								OPENVPN_LOG_CLIPROTO("TUN send, size=" << job.buf.size());
+								DATA_PATH::tun_send(*tun, job.buf);
+							}
+						}
+					}
+				}
+				catch (const std::exception& e)
+				{
+					process_exception(e, "work_complete");
+				}
+			}
+
 			virtual void transport_pre_resolve()
 			{
 				ClientEvent::Base::Ptr ev = new ClientEvent::Resolve();
@@ -355,6 +558,7 @@ namespace openvpn {
 			{
 				try {
 					OPENVPN_LOG("Connecting to " << server_endpoint_render());
+					connect_start = now();
 					Base::start();
 					Base::flush(true);
 					set_housekeeping_timer();
@@ -437,6 +641,8 @@ namespace openvpn {
 						pushed_options_filter.get());
 					if (received_options.complete())
 					{
+						push_reply_time = now();
+
 						// show options
 						OPENVPN_LOG("OPTIONS:" << std::endl << render_options_sanitized(received_options, Option::RENDER_PASS_FMT|Option::RENDER_NUMBER|Option::RENDER_BRACKET));
 
@@ -527,6 +733,7 @@ namespace openvpn {
 				ev->tun_name = tun->tun_name();
 				cli_events->add_event(ev);
 				connected_ = true;
+				connect_timing_event();
 				if (notify_callback)
 					notify_callback->client_proto_connected();
 			}
@@ -578,7 +785,12 @@ namespace openvpn {
 						Base::write_control_string(std::string("PUSH_REQUEST"));
 						Base::flush(true);
 						set_housekeeping_timer();
-						schedule_push_request_callback(false);
+						++push_requests;
+
+						// back off exponentially until the reply arrives
+						schedule_push_request_callback(push_request_interval);
+						push_request_interval = Time::Duration::binary_ms(push_request_interval.raw() * 2);
+						push_request_interval.min(Time::Duration::binary_ms(PUSH_REQUEST_MAX_MS * Time::prec / 1000));
 					}
 				}
 				catch (const std::exception& e)
@@ -587,11 +799,11 @@ namespace openvpn {
 				}
 			}
 
-			void schedule_push_request_callback(bool short_time)
+			void schedule_push_request_callback(const Time::Duration& delay)
 			{
 				if (!received_options.partial())
 				{
-					push_request_timer.expires_at(now() + (short_time ? Time::Duration::seconds(1) : Time::Duration::seconds(3)));
+					push_request_timer.expires_at(now() + delay);
 					push_request_timer.async_wait(asio_dispatch_timer(&Session::send_push_request_callback, this));
 				}
 			}
@@ -600,7 +812,36 @@ namespace openvpn {
 			virtual void active()
 			{
 				OPENVPN_LOG("Session is ACTIVE");
-				schedule_push_request_callback(true);
+				active_time = now();
+
+				// prefer the smoothed RTT of the whole handshake, if the
+				// reliability layer has one, to that of the first reply
+				if (Base::control_rto().defined())
+					control_rtt = Base::control_rto().srtt();
+
+				// First retry after twice the measured RTT, within bounds.
+				// The request itself goes out as soon as we return to the
+				// event loop, rather than from inside the protocol object.
+				push_request_interval = Time::Duration::binary_ms(control_rtt.raw() * 2);
+				push_request_interval.max(Time::Duration::binary_ms(PUSH_REQUEST_MIN_MS * Time::prec / 1000));
+				push_request_interval.min(Time::Duration::binary_ms(PUSH_REQUEST_MAX_MS * Time::prec / 1000));
+				schedule_push_request_callback(Time::Duration());
+			}
+
+			void connect_timing_event()
+			{
+				if (!connect_start.defined())
+					return;
+				ClientEvent::ConnectTiming::Ptr ev = new ClientEvent::ConnectTiming();
+				ev->rtt_ms = (unsigned int)control_rtt.to_milliseconds();
+				if (active_time.defined())
+					ev->active_ms = (unsigned int)(active_time - connect_start).to_milliseconds();
+				if (push_reply_time.defined())
+					ev->push_reply_ms = (unsigned int)(push_reply_time - connect_start).to_milliseconds();
+				ev->connected_ms = (unsigned int)(now() - connect_start).to_milliseconds();
+				ev->push_requests = push_requests;
+				OPENVPN_LOG("Connect timing: " << ev->render());
+				cli_events->add_event(ev);
 			}
 
 			void housekeeping_callback(const boost::system::error_code& e)
@@ -632,8 +873,19 @@ namespace openvpn {
 				}
 			}
 
+			// deadline on Base::conf().timer_wheel
+			virtual void deadline_expired()
+			{
+				Ptr self(this); // housekeeping may stop us
+				housekeeping_callback(boost::system::error_code());
+			}
+
 			void set_housekeeping_timer()
 			{
+				// the timer wheel already holds each deadline
+				if (Base::conf().timer_wheel)
+					return;
+
 				Time next = Base::next_housekeeping();
 				if (!housekeeping_schedule.similar(next))
 				{
@@ -758,6 +1010,8 @@ namespace openvpn {
 			TunClientFactory::Ptr tun_factory;
 			TunClient::Ptr tun;
 
+			typename DataPipeline::Ptr pipeline;
+
 			NotifyCallback* notify_callback;
 
 			CoarseTime housekeeping_schedule;
@@ -773,6 +1027,14 @@ namespace openvpn {
 
 			bool first_packet_received_;
 			bool sent_push_request;
+			unsigned int push_requests;
+			Time::Duration push_request_interval;
+
+			// connect phase timing
+			Time connect_start;
+			Time::Duration control_rtt;
+			Time active_time;
+			Time push_reply_time;
 
 			SessionStats::Ptr cli_stats;
 			ClientEvent::Queue::Ptr cli_events;
@@ -0,0 +1,134 @@
+//    OpenVPN -- An application to securely tunnel IP networks
+//               over a single port, with support for SSL/TLS-based
+//               session authentication and key exchange,
+//               packet encryption, packet authentication, and
+//               packet compression.
+//
+//    Copyright (C) 2013 OpenVPN Technologies, Inc.
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Affero General Public License Version 3
+//    as published by the Free Software Foundation.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Affero General Public License for more details.
+//
+//    You should have received a copy of the GNU Affero General Public License
+//    along with this program in the COPYING file.
+//    If not, see <http://www.gnu.org/licenses/>.
+
+// A small arena for the memory that Asio allocates for each pending
+// asynchronous operation.  Dispatchers constructed with an arena (see
+// asiodispatch.hpp) obtain this memory through the asio_handler_allocate
+// hook.  Freed slots are kept for reuse rather than returned to the heap,
+// so once an object has as many slots as it ever has operations pending,
+// its operations complete without calling malloc or free.
+//
+// An arena is not thread-safe, and must only serve operations that are
+// started and completed on a single thread.  The arena must outlive its
+// operations, which is normally the case when it is a member of the
+// object that the dispatchers hold a reference to.
+
+#ifndef OPENVPN_COMMON_ASIOARENA_H
+#define OPENVPN_COMMON_ASIOARENA_H
+
+#include <cstddef>
+#include <new>
+
+#include <boost/noncopyable.hpp>
+
+#include <openvpn/common/types.hpp>
+
+namespace openvpn {
+
+  class AsioHandlerArena : boost::noncopyable
+  {
+  public:
+    enum {
+      SLOT_SIZE = 512, // larger than any socket or descriptor operation
+    };
+
+    AsioHandlerArena()
+      : free_list(NULL), n_slots_(0), n_oversize_(0) {}
+
+    ~AsioHandlerArena()
+    {
+      while (free_list)
+	{
+	  Slot* s = free_list;
+	  free_list = s->next;
+	  ::operator delete(s);
+	}
+    }
+
+    // allocate through arena if defined, otherwise from the heap
+    static void* allocate(AsioHandlerArena* arena, const std::size_t size)
+    {
+      if (arena)
+	return arena->allocate(size);
+      else
+	return ::operator new(size);
+    }
+
+    static void deallocate(AsioHandlerArena* arena, void* pointer, const std::size_t size)
+    {
+      if (arena)
+	arena->deallocate(pointer, size);
+      else
+	::operator delete(pointer);
+    }
+
+    void* allocate(const std::size_t size)
+    {
+      if (size <= SLOT_SIZE)
+	{
+	  if (free_list)
+	    {
+	      Slot* s = free_list;
+	      free_list = s->next;
+	      return s;
+	    }
+	  ++n_slots_;
+	  return ::operator new(SLOT_SIZE);
+	}
+      ++n_oversize_;
+      return ::operator new(size);
+    }
+
+    // size must be the size passed to allocate
+    void deallocate(void* pointer, const std::size_t size)
+    {
+      if (size <= SLOT_SIZE)
+	{
+	  Slot* s = static_cast<Slot*>(pointer);
+	  s->next = free_list;
+	  free_list = s;
+	}
+      else
+	::operator delete(pointer);
+    }
+
+    // Number of heap allocations made by the arena: slots, which level
+    // off at the peak number of pending operations, plus oversize
+    // requests, which should never happen.
+    count_t heap_allocs() const { return n_slots_ + n_oversize_; }
+
+    count_t n_slots() const { return n_slots_; }
+    count_t n_oversize() const { return n_oversize_; }
+
+  private:
+    struct Slot
+    {
+      Slot* next;
+    };
+
+    Slot* free_list;
+    count_t n_slots_;
+    count_t n_oversize_;
+  };
+
+} // namespace openvpn
+
+#endif // OPENVPN_COMMON_ASIOARENA_H
@@ -23,12 +23,17 @@
 // for Asio methods.  Think of these as optimized special cases of function
 // objects that could be more generally (but perhaps less optimally) defined
 // with boost::bind.
+//
+// The read, ready and write dispatchers, used for per-packet I/O, can
+// optionally be given an AsioHandlerArena from which Asio will allocate
+// the memory for the pending operation.
 
 #ifndef OPENVPN_COMMON_ASIODISPATCH_H
 #define OPENVPN_COMMON_ASIODISPATCH_H
 
 #include <openvpn/common/types.hpp>
 #include <openvpn/common/rc.hpp>
+#include <openvpn/common/asioarena.hpp>
 
 namespace openvpn {
   // Dispatcher for asio async_write
@@ -37,23 +42,34 @@ namespace openvpn {
   class AsioDispatchWrite
   {
   public:
-    AsioDispatchWrite(Handler handle_write, C* obj)
-      : handle_write_(handle_write), obj_(obj) {}
+    AsioDispatchWrite(Handler handle_write, C* obj, AsioHandlerArena* arena)
+      : handle_write_(handle_write), obj_(obj), arena_(arena) {}
 
     void operator()(const boost::system::error_code& error, const size_t bytes_sent)
     {
       (obj_.get()->*handle_write_)(error, bytes_sent);
     }
 
+    friend void* asio_handler_allocate(std::size_t size, AsioDispatchWrite* self)
+    {
+      return AsioHandlerArena::allocate(self->arena_, size);
+    }
+
+    friend void asio_handler_deallocate(void* pointer, std::size_t size, AsioDispatchWrite* self)
+    {
+      AsioHandlerArena::deallocate(self->arena_, pointer, size);
+    }
+
   private:
     Handler handle_write_;
     boost::intrusive_ptr<C> obj_;
+    AsioHandlerArena* arena_;
   };
 
   template <typename C, typename Handler>
-  AsioDispatchWrite<C, Handler> asio_dispatch_write(Handler handle_write, C* obj)
+  AsioDispatchWrite<C, Handler> asio_dispatch_write(Handler handle_write, C* obj, AsioHandlerArena* arena = NULL)
   {
-    return AsioDispatchWrite<C, Handler>(handle_write, obj);
+    return AsioDispatchWrite<C, Handler>(handle_write, obj, arena);
   }
 
   // Dispatcher for asio async_read
@@ -62,24 +78,72 @@ namespace openvpn {
   class AsioDispatchRead
   {
   public:
-    AsioDispatchRead(Handler handle_read, C* obj, Data data)
-      : handle_read_(handle_read), obj_(obj), data_(data) {}
+    AsioDispatchRead(Handler handle_read, C* obj, Data data, AsioHandlerArena* arena)
+      : handle_read_(handle_read), obj_(obj), data_(data), arena_(arena) {}
 
     void operator()(const boost::system::error_code& error, const size_t bytes_recvd)
     {
       (obj_.get()->*handle_read_)(data_, error, bytes_recvd);
     }
 
+    friend void* asio_handler_allocate(std::size_t size, AsioDispatchRead* self)
+    {
+      return AsioHandlerArena::allocate(self->arena_, size);
+    }
+
+    friend void asio_handler_deallocate(void* pointer, std::size_t size, AsioDispatchRead* self)
+    {
+      AsioHandlerArena::deallocate(self->arena_, pointer, size);
+    }
+
   private:
     Handler handle_read_;
     boost::intrusive_ptr<C> obj_;
     Data data_;
+    AsioHandlerArena* arena_;
   };
 
   template <typename C, typename Handler, typename Data>
-  AsioDispatchRead<C, Handler, Data> asio_dispatch_read(Handler handle_read, C* obj, Data data)
+  AsioDispatchRead<C, Handler, Data> asio_dispatch_read(Handler handle_read, C* obj, Data data, AsioHandlerArena* arena = NULL)
+  {
+    return AsioDispatchRead<C, Handler, Data>(handle_read, obj, data, arena);
+  }
+
+  // Dispatcher for asio async_read_some/async_receive with null_buffers,
+  // which waits for the descriptor to become readable without reading
+
+  template <typename C, typename Handler>
+  class AsioDispatchReady
+  {
+  public:
+    AsioDispatchReady(Handler handle_ready, C* obj, AsioHandlerArena* arena)
+      : handle_ready_(handle_ready), obj_(obj), arena_(arena) {}
+
+    void operator()(const boost::system::error_code& error, const size_t)
+    {
+      (obj_.get()->*handle_ready_)(error);
+    }
+
+    friend void* asio_handler_allocate(std::size_t size, AsioDispatchReady* self)
+    {
+      return AsioHandlerArena::allocate(self->arena_, size);
+    }
+
+    friend void asio_handler_deallocate(void* pointer, std::size_t size, AsioDispatchReady* self)
+    {
+      AsioHandlerArena::deallocate(self->arena_, pointer, size);
+    }
+
+  private:
+    Handler handle_ready_;
+    boost::intrusive_ptr<C> obj_;
+    AsioHandlerArena* arena_;
+  };
+
+  template <typename C, typename Handler>
+  AsioDispatchReady<C, Handler> asio_dispatch_ready(Handler handle_ready, C* obj, AsioHandlerArena* arena = NULL)
   {
-    return AsioDispatchRead<C, Handler, Data>(handle_read, obj, data);
+    return AsioDispatchReady<C, Handler>(handle_ready, obj, arena);
   }
 
   // Dispatcher for asio async_wait with argument
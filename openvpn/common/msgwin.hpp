@@ -81,6 +81,13 @@ namespace openvpn {
 	throw message_window_ref_by_id();
     }
 
+    // Return true if the M object at id is defined, without
+    // growing the queue
+    bool defined_by_id(const id_t id) const
+    {
+      return in_window(id) && id - head_id_ < q_.size() && q_[id - head_id_].defined();
+    }
+
     // Remove the M object at id, is a no-op if
     // id not in window.  Do a purge() as a last
     // step to advance the head_id_ if it's now
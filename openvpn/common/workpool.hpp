@@ -0,0 +1,247 @@
+//    OpenVPN -- An application to securely tunnel IP networks
+//               over a single port, with support for SSL/TLS-based
+//               session authentication and key exchange,
+//               packet encryption, packet authentication, and
+//               packet compression.
+//
+//    Copyright (C) 2013 OpenVPN Technologies, Inc.
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Affero General Public License Version 3
+//    as published by the Free Software Foundation.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Affero General Public License for more details.
+//
+//    You should have received a copy of the GNU Affero General Public License
+//    along with this program in the COPYING file.
+//    If not, see <http://www.gnu.org/licenses/>.
+
+
+// A pool of worker threads that runs jobs on behalf of the thread
+// driving an io_service, then hands the finished jobs back to that
+// thread in the order they were submitted.
+
+#ifndef OPENVPN_COMMON_WORKPOOL_H
+#define OPENVPN_COMMON_WORKPOOL_H
+
+#include <vector>
+
+#include <boost/asio.hpp>
+#include <boost/atomic.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/lockfree/spsc_queue.hpp>
+
+#include <openvpn/common/types.hpp>
+#include <openvpn/common/exception.hpp>
+#include <openvpn/common/rc.hpp>
+#include <openvpn/common/scoped_ptr.hpp>
+#include <openvpn/common/asiodispatch.hpp>
+
+namespace openvpn {
+
+  // JOB must be default constructible and provide
+  //
+  //   void run(const size_t worker_index);
+  //
+  // which is called on a worker thread.  A given worker_index is only
+  // ever used by one thread, so jobs may use it to select per-worker
+  // state that needs no locking.
+  //
+  // HANDLER must provide
+  //
+  //   void work_complete(JOB& job);
+  //
+  // which is called on the io_service thread for each job, in submission
+  // order.  All other methods must also be called on the io_service thread.
+  //
+  // Jobs live in a ring of queue_size slots.  The io_service thread
+  // fills in a slot obtained from next_job() and passes it to a worker
+  // with submit().  Workers are fed round-robin through single-producer,
+  // single-consumer lock-free queues and only sleep on a condition
+  // variable when their queue runs dry.  A worker that completes a job
+  // posts a drain to the io_service unless one is already pending, so
+  // a burst of completions costs a single post.
+  //
+  // stop() must be called before the last reference is dropped.
+  template <typename JOB, typename HANDLER>
+  class OrderedWorkPool : public RC<thread_safe_refcount>
+  {
+  public:
+    typedef boost::intrusive_ptr<OrderedWorkPool> Ptr;
+
+    OPENVPN_SIMPLE_EXCEPTION(workpool_bad_parms);
+
+    OrderedWorkPool(boost::asio::io_service& io_service_arg,
+		    HANDLER* handler_arg,
+		    const size_t n_workers,
+		    const size_t queue_size)  // must be a power of 2
+      : io_service(io_service_arg),
+	handler(handler_arg),
+	mask(queue_size - 1),
+	head(0),
+	tail(0),
+	halt(false),
+	notify_pending(false)
+    {
+      if (!n_workers || !queue_size || (queue_size & mask))
+	throw workpool_bad_parms();
+      slots.reset(new Slot[queue_size]);
+      for (size_t i = 0; i < n_workers; ++i)
+	workers.push_back(new Worker(queue_size));
+      for (size_t i = 0; i < n_workers; ++i)
+	workers[i]->thread = new boost::thread(&OrderedWorkPool::worker_thread, this, i);
+    }
+
+    size_t n_workers() const { return workers.size(); }
+
+    // number of jobs submitted but not yet delivered to work_complete
+    size_t in_flight() const { return head - tail; }
+
+    // Return the next free job slot, or NULL if the pool is full.
+    // The slot is not handed to a worker until submit() is called.
+    JOB* next_job()
+    {
+      if (halt || head - tail > mask)
+	return NULL;
+      return &slots.get()[head & mask].job;
+    }
+
+    // pass the slot returned by next_job() to a worker
+    void submit()
+    {
+      const size_t index = head & mask;
+      Worker& w = *workers[head % workers.size()];
+      ++head;
+      w.queue.push(index);
+
+      // order the push above against the load of sleeping below,
+      // pairing with the same fence in worker_thread
+      boost::atomic_thread_fence(boost::memory_order_seq_cst);
+      if (w.sleeping.load(boost::memory_order_relaxed))
+	{
+	  boost::mutex::scoped_lock lock(w.mutex);
+	  w.cond.notify_one();
+	}
+    }
+
+    void stop()
+    {
+      if (!halt)
+	{
+	  halt = true;
+	  handler = NULL;
+	  for (size_t i = 0; i < workers.size(); ++i)
+	    {
+	      Worker& w = *workers[i];
+	      {
+		boost::mutex::scoped_lock lock(w.mutex);
+		w.cond.notify_one();
+	      }
+	      if (w.thread)
+		w.thread->join();
+	    }
+	}
+    }
+
+    virtual ~OrderedWorkPool()
+    {
+      stop();
+      for (size_t i = 0; i < workers.size(); ++i)
+	delete workers[i];
+    }
+
+  private:
+    struct Slot
+    {
+      Slot() : done(false) {}
+
+      JOB job;
+      boost::atomic<bool> done;
+    };
+
+    struct Worker
+    {
+      Worker(const size_t queue_size)
+	: queue(queue_size),
+	  sleeping(false),
+	  thread(NULL)
+      {
+      }
+
+      ~Worker()
+      {
+	delete thread;
+      }
+
+      boost::lockfree::spsc_queue<size_t> queue;
+      boost::atomic<bool> sleeping;
+      boost::mutex mutex;
+      boost::condition_variable cond;
+      boost::thread* thread;
+    };
+
+    void worker_thread(const size_t worker_index)
+    {
+      Worker& w = *workers[worker_index];
+      while (true)
+	{
+	  size_t index;
+	  while (w.queue.pop(index))
+	    {
+	      Slot& s = slots.get()[index];
+	      s.job.run(worker_index);
+	      // seq_cst pairs with drain(), see there
+	      s.done.store(true, boost::memory_order_seq_cst);
+	      if (!notify_pending.exchange(true, boost::memory_order_seq_cst))
+		io_service.post(asio_dispatch_post(&OrderedWorkPool::drain, this));
+	    }
+
+	  boost::mutex::scoped_lock lock(w.mutex);
+	  w.sleeping.store(true, boost::memory_order_relaxed);
+	  boost::atomic_thread_fence(boost::memory_order_seq_cst);
+	  if (halt)
+	    break;
+	  if (!w.queue.read_available())
+	    w.cond.wait(lock);
+	  w.sleeping.store(false, boost::memory_order_relaxed);
+	}
+    }
+
+    // deliver completed jobs to handler in submission order
+    void drain()
+    {
+      // Clearing notify_pending and then reading done races with a
+      // worker setting done and then testing notify_pending.  Both
+      // sides must be seq_cst so that at least one sees the other's
+      // store, or a completed job could wait for a drain never posted.
+      notify_pending.store(false, boost::memory_order_seq_cst);
+      while (handler && tail != head)
+	{
+	  Slot& s = slots.get()[tail & mask];
+	  if (!s.done.load(boost::memory_order_seq_cst))
+	    break;
+	  s.done.store(false, boost::memory_order_relaxed);
+	  handler->work_complete(s.job);
+	  ++tail; // only now may the slot be reused by next_job()
+	}
+    }
+
+    boost::asio::io_service& io_service;
+    HANDLER* handler;
+    ScopedPtr<Slot, PtrArrayFree> slots;
+    std::vector<Worker*> workers;
+    const size_t mask;
+    size_t head; // next sequence number to submit
+    size_t tail; // next sequence number to deliver
+    boost::atomic<bool> halt;
+    boost::atomic<bool> notify_pending;
+  };
+
+} // namespace openvpn
+
+#endif // OPENVPN_COMMON_WORKPOOL_H
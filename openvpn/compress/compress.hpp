@@ -150,6 +150,9 @@ namespace openvpn {
 
     unsigned int extra_payload_bytes() const { return type_ == NONE ? 0 : 1; }
 
+    // true if new_compressor returns a CompressNull
+    bool is_null() const { return type_ == NONE; }
+
     Compress::Ptr new_compressor(const Frame::Ptr& frame, const SessionStats::Ptr& stats)
     {
       switch (type_)
@@ -0,0 +1,95 @@
+//    OpenVPN -- An application to securely tunnel IP networks
+//               over a single port, with support for SSL/TLS-based
+//               session authentication and key exchange,
+//               packet encryption, packet authentication, and
+//               packet compression.
+//
+//    Copyright (C) 2013 OpenVPN Technologies, Inc.
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Affero General Public License Version 3
+//    as published by the Free Software Foundation.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Affero General Public License for more details.
+//
+//    You should have received a copy of the GNU Affero General Public License
+//    along with this program in the COPYING file.
+//    If not, see <http://www.gnu.org/licenses/>.
+
+// Nonce for AEAD ciphers (such as AES-GCM) on the OpenVPN data channel
+
+#ifndef OPENVPN_CRYPTO_AEAD_H
+#define OPENVPN_CRYPTO_AEAD_H
+
+#include <cstring>
+
+#include <openvpn/common/types.hpp>
+#include <openvpn/common/exception.hpp>
+#include <openvpn/common/socktypes.hpp>
+#include <openvpn/crypto/static_key.hpp>
+#include <openvpn/crypto/packet_id.hpp>
+
+namespace openvpn {
+
+  // The 12-byte AEAD nonce is the 4-byte packet ID (sent in the clear and
+  // authenticated as associated data) followed by an 8-byte implicit IV
+  // that both peers take from the head of the otherwise unused HMAC key
+  // for that direction.  Since packet IDs never repeat under a given key,
+  // neither does the nonce.
+  class AEADNonce
+  {
+  public:
+    OPENVPN_SIMPLE_EXCEPTION(aead_nonce_key_size);
+
+    enum {
+      PID_SIZE = sizeof(PacketID::id_t),
+      IMPLICIT_IV_SIZE = 8,
+      NONCE_SIZE = PID_SIZE + IMPLICIT_IV_SIZE,
+    };
+
+    AEADNonce()
+    {
+      std::memset(data, 0, sizeof(data));
+    }
+
+    ~AEADNonce()
+    {
+      std::memset(data, 0, sizeof(data));
+    }
+
+    void set_implicit_iv(const StaticKey& key)
+    {
+      if (key.size() < IMPLICIT_IV_SIZE)
+	throw aead_nonce_key_size();
+      std::memcpy(data + PID_SIZE, key.data(), IMPLICIT_IV_SIZE);
+    }
+
+    // set packet ID portion from a packet ID we are about to send
+    void set_pid(const PacketID& pid)
+    {
+      const PacketID::id_t net_id = htonl(pid.id);
+      std::memcpy(data, &net_id, PID_SIZE);
+    }
+
+    // set packet ID portion from the head of a received packet
+    void set_pid(const unsigned char *net_pid)
+    {
+      std::memcpy(data, net_pid, PID_SIZE);
+    }
+
+    const unsigned char *iv() const { return data; }
+
+    // associated data is the packet ID as it appears on the wire
+    const unsigned char *ad() const { return data; }
+    size_t ad_size() const { return PID_SIZE; }
+
+  private:
+    unsigned char data[NONCE_SIZE];
+  };
+
+} // namespace openvpn
+
+#endif // OPENVPN_CRYPTO_AEAD_H
@@ -60,12 +60,31 @@ namespace openvpn {
       return ctx.iv_length();
     }
 
+    // cipher block size, also the worst-case padding expansion
+    size_t block_size() const
+    {
+      return ctx.block_size();
+    }
+
     // cipher mode (such as CIPH_CBC_MODE, etc.)
     int cipher_mode() const
     {
       return ctx.cipher_mode();
     }
 
+    // true for AEAD ciphers such as AES-GCM, which are used
+    // via aead_encrypt/aead_decrypt rather than encrypt/decrypt
+    bool is_aead() const
+    {
+      return ctx.is_aead();
+    }
+
+    // size of AEAD authentication tag
+    static size_t aead_tag_length()
+    {
+      return CRYPTO_API::CipherContext::AEAD_TAG_LENGTH;
+    }
+
     // size of out buffer to pass to encrypt_decrypt
     size_t output_size(const size_t in_size) const
     {
@@ -123,6 +142,32 @@ namespace openvpn {
       return outlen;
     }
 
+    bool aead_encrypt(const unsigned char *iv,
+		      unsigned char *out, const size_t out_size,
+		      const unsigned char *in, const size_t in_size,
+		      const unsigned char *ad, const size_t ad_size,
+		      unsigned char *tag)
+    {
+      if (mode_ != CRYPTO_API::CipherContext::ENCRYPT)
+	throw cipher_mode_error();
+      if (out_size < in_size)
+	throw cipher_output_buffer();
+      return ctx.aead_encrypt(iv, out, in, in_size, ad, ad_size, tag);
+    }
+
+    bool aead_decrypt(const unsigned char *iv,
+		      unsigned char *out, const size_t out_size,
+		      const unsigned char *in, const size_t in_size,
+		      const unsigned char *ad, const size_t ad_size,
+		      const unsigned char *tag)
+    {
+      if (mode_ != CRYPTO_API::CipherContext::DECRYPT)
+	throw cipher_mode_error();
+      if (out_size < in_size)
+	throw cipher_output_buffer();
+      return ctx.aead_decrypt(iv, out, in, in_size, ad, ad_size, tag);
+    }
+
   private:
     int mode_;
     typename CRYPTO_API::CipherContext ctx;
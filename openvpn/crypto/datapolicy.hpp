@@ -0,0 +1,85 @@
+//    OpenVPN -- An application to securely tunnel IP networks
+//               over a single port, with support for SSL/TLS-based
+//               session authentication and key exchange,
+//               packet encryption, packet authentication, and
+//               packet compression.
+//
+//    Copyright (C) 2013 OpenVPN Technologies, Inc.
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Affero General Public License Version 3
+//    as published by the Free Software Foundation.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Affero General Public License for more details.
+//
+//    You should have received a copy of the GNU Affero General Public License
+//    along with this program in the COPYING file.
+//    If not, see <http://www.gnu.org/licenses/>.
+
+
+// Registry of the data channel cipher/digest layouts that Encrypt and
+// Decrypt have fixed-size code for
+
+#ifndef OPENVPN_CRYPTO_DATAPOLICY_H
+#define OPENVPN_CRYPTO_DATAPOLICY_H
+
+#include <openvpn/common/types.hpp>
+#include <openvpn/crypto/cipher.hpp>
+#include <openvpn/crypto/hmac.hpp>
+
+namespace openvpn {
+
+  // Encrypt and Decrypt select a policy once, after their cipher and
+  // HMAC are keyed.  A CBC policy fixes the IV length (which is also
+  // the cipher block size) and HMAC size at compile time, so that the
+  // per-packet code has no mode or size checks and the IV and HMAC
+  // copies are of constant length.  Layouts not in the table, and
+  // objects that never select a policy, use the generic code.
+  struct DataCryptoPolicy
+  {
+    enum Type {
+      GENERIC,      // any cipher/digest, checked per packet
+      AEAD,         // AEAD cipher such as AES-GCM
+      CBC16_HMAC20, // 128-bit block CBC cipher (AES) with SHA1
+      CBC16_HMAC32, // 128-bit block CBC cipher with SHA256
+      CBC16_HMAC64, // 128-bit block CBC cipher with SHA512
+      CBC8_HMAC20,  // 64-bit block CBC cipher (BF, DES-EDE3) with SHA1
+    };
+
+    template <typename CRYPTO_API>
+    static Type select(const CipherContext<CRYPTO_API>& cipher, const HMACContext<CRYPTO_API>& hmac)
+    {
+      static const struct {
+	size_t iv_length;
+	size_t hmac_size;
+	Type type;
+      } registry[] = {
+	{ 16, 20, CBC16_HMAC20 },
+	{ 16, 32, CBC16_HMAC32 },
+	{ 16, 64, CBC16_HMAC64 },
+	{ 8,  20, CBC8_HMAC20 },
+      };
+
+      if (!cipher.defined())
+	return GENERIC;
+      if (cipher.is_aead())
+	return AEAD;
+      if (!hmac.defined() || cipher.cipher_mode() != CRYPTO_API::CipherContext::CIPH_CBC_MODE)
+	return GENERIC;
+      const size_t iv_length = cipher.iv_length();
+      if (cipher.block_size() != iv_length)
+	return GENERIC;
+      const size_t hmac_size = hmac.output_size();
+      for (size_t i = 0; i < sizeof(registry) / sizeof(registry[0]); ++i)
+	if (registry[i].iv_length == iv_length && registry[i].hmac_size == hmac_size)
+	  return registry[i].type;
+      return GENERIC;
+    }
+  };
+
+} // namespace openvpn
+
+#endif // OPENVPN_CRYPTO_DATAPOLICY_H
@@ -36,6 +36,8 @@
 #include <openvpn/crypto/hmac.hpp>
 #include <openvpn/crypto/static_key.hpp>
 #include <openvpn/crypto/packet_id.hpp>
+#include <openvpn/crypto/aead.hpp>
+#include <openvpn/crypto/datapolicy.hpp>
 #include <openvpn/log/sessionstats.hpp>
 
 namespace openvpn {
@@ -45,12 +47,103 @@ namespace openvpn {
   public:
     OPENVPN_SIMPLE_EXCEPTION(unsupported_cipher_mode);
 
-    Error::Type decrypt(BufferAllocated& buf, const PacketID::time_t now)
+    Decrypt() : policy(DataCryptoPolicy::GENERIC) {}
+
+    // call after keying cipher and hmac
+    void select_policy()
+    {
+      policy = DataCryptoPolicy::select(cipher, hmac);
+    }
+
+    // If pid_out is non-NULL, the packet ID is returned there instead
+    // of being checked against pid_recv, and the caller is expected to
+    // pass it to accept_packet_id once the packet is back in order.
+    Error::Type decrypt(BufferAllocated& buf, const PacketID::time_t now, PacketID *pid_out = NULL)
     {
       // skip null packets
       if (!buf.size())
 	return Error::SUCCESS;
 
+      switch (policy)
+	{
+	case DataCryptoPolicy::AEAD:
+	  return decrypt_aead(buf, now, pid_out);
+	case DataCryptoPolicy::CBC16_HMAC20:
+	  return decrypt_cbc_hmac<16, 20>(buf, now, pid_out);
+	case DataCryptoPolicy::CBC16_HMAC32:
+	  return decrypt_cbc_hmac<16, 32>(buf, now, pid_out);
+	case DataCryptoPolicy::CBC16_HMAC64:
+	  return decrypt_cbc_hmac<16, 64>(buf, now, pid_out);
+	case DataCryptoPolicy::CBC8_HMAC20:
+	  return decrypt_cbc_hmac<8, 20>(buf, now, pid_out);
+	default:
+	  return decrypt_generic(buf, now, pid_out);
+	}
+    }
+
+    // replay check of a packet ID returned by decrypt
+    bool accept_packet_id(const PacketID& pid, const PacketID::time_t now)
+    {
+      if (pid_recv.initialized())
+	{
+	  if (pid_recv.test(pid, now)) // verify packet ID
+	    pid_recv.add(pid, now);    // remember packet ID
+	  else
+	    return false;
+	}
+      return true;
+    }
+
+    Frame::Ptr frame;
+    CipherContext<CRYPTO_API> cipher;
+    HMACContext<CRYPTO_API> hmac;
+    PacketIDReceive pid_recv;
+    AEADNonce nonce; // implicit IV portion set at key init time, AEAD mode only
+
+  private:
+    // CBC cipher with an IV and block size of IV_LEN bytes,
+    // authenticated by an HMAC of HMAC_LEN bytes
+    template <size_t IV_LEN, size_t HMAC_LEN>
+    Error::Type decrypt_cbc_hmac(BufferAllocated& buf, const PacketID::time_t now, PacketID *pid_out)
+    {
+      // verify the HMAC
+      unsigned char local_hmac[HMAC_LEN];
+      const unsigned char *packet_hmac = buf.read_alloc(HMAC_LEN);
+      hmac.hmac(local_hmac, HMAC_LEN, buf.c_data(), buf.size());
+      if (memcmp_secure(local_hmac, packet_hmac, HMAC_LEN))
+	{
+	  buf.reset_size();
+	  return Error::HMAC_ERROR;
+	}
+
+      // extract IV from head of packet
+      unsigned char iv_buf[IV_LEN];
+      std::memcpy(iv_buf, buf.read_alloc(IV_LEN), IV_LEN);
+
+      // decrypt buf in place
+      ensure_tailroom(buf, IV_LEN);
+      const size_t decrypt_bytes = cipher.decrypt(iv_buf, buf.data(), buf.max_size(), buf.c_data(), buf.size());
+      if (!decrypt_bytes)
+	{
+	  buf.reset_size();
+	  return Error::DECRYPT_ERROR;
+	}
+      buf.set_size(decrypt_bytes);
+
+      if (!verify_packet_id(buf, now, pid_out))
+	{
+	  buf.reset_size();
+	  return Error::REPLAY_ERROR;
+	}
+      return Error::SUCCESS;
+    }
+
+    Error::Type decrypt_generic(BufferAllocated& buf, const PacketID::time_t now, PacketID *pid_out)
+    {
+      // AEAD mode authenticates and decrypts in a single pass
+      if (cipher.defined() && cipher.is_aead())
+	return decrypt_aead(buf, now, pid_out);
+
       // verify the HMAC
       if (hmac.defined())
 	{
@@ -74,23 +167,25 @@ namespace openvpn {
 	  // extract IV from head of packet
 	  buf.read(iv_buf, iv_length);
 
-	  // initialize work buffer
-	  frame->prepare(Frame::DECRYPT_WORK, work);
+	  // cleartext is never longer than ciphertext, so we can decrypt
+	  // in place as long as there is tailroom for the cipher's
+	  // worst-case output sizing
+	  ensure_tailroom(buf, cipher.block_size());
 
-	  // decrypt from buf -> work
-	  const size_t decrypt_bytes = cipher.decrypt(iv_buf, work.data(), work.max_size(), buf.c_data(), buf.size());
+	  // decrypt buf in place
+	  const size_t decrypt_bytes = cipher.decrypt(iv_buf, buf.data(), buf.max_size(), buf.c_data(), buf.size());
 	  if (!decrypt_bytes)
 	    {
 	      buf.reset_size();
 	      return Error::DECRYPT_ERROR;
 	    }
-	  work.set_size(decrypt_bytes);
+	  buf.set_size(decrypt_bytes);
 
 	  // handle different cipher modes
 	  const int cipher_mode = cipher.cipher_mode();
 	  if (cipher_mode == CRYPTO_API::CipherContext::CIPH_CBC_MODE)
 	    {
-	      if (!verify_packet_id(work, now))
+	      if (!verify_packet_id(buf, now, pid_out))
 		{
 		  buf.reset_size();
 		  return Error::REPLAY_ERROR;
@@ -100,13 +195,10 @@ namespace openvpn {
 	    {
 	      throw unsupported_cipher_mode();
 	    }
-
-	  // return cleartext result in buf
-	  buf.swap(work);
 	}
       else // no encryption
 	{
-	  if (!verify_packet_id(buf, now))
+	  if (!verify_packet_id(buf, now, pid_out))
 	    {
 	      buf.reset_size();
 	      return Error::REPLAY_ERROR;
@@ -115,26 +207,71 @@ namespace openvpn {
       return Error::SUCCESS;
     }
 
-    Frame::Ptr frame;
-    CipherContext<CRYPTO_API> cipher;
-    HMACContext<CRYPTO_API> hmac;
-    PacketIDReceive pid_recv;
+    // packet format is [ packet ID ] [ tag ] [ ciphertext ]
+    Error::Type decrypt_aead(BufferAllocated& buf, const PacketID::time_t now, PacketID *pid_out)
+    {
+      const size_t tag_length = cipher.aead_tag_length();
+      if (buf.size() < AEADNonce::PID_SIZE + tag_length)
+	{
+	  buf.reset_size();
+	  return Error::DECRYPT_ERROR;
+	}
 
-  private:
-    bool verify_packet_id(BufferAllocated& buf, const PacketID::time_t now)
+      // packet ID doubles as nonce prefix and associated data
+      nonce.set_pid(buf.c_data());
+      PacketID pid;
+      pid.read(buf, PacketID::SHORT_FORM);
+      const unsigned char *tag = buf.read_alloc(tag_length);
+
+      // authenticate and decrypt in place
+      if (!cipher.aead_decrypt(nonce.iv(), buf.data(), buf.size(), buf.c_data(), buf.size(),
+			       nonce.ad(), nonce.ad_size(), tag))
+	{
+	  buf.reset_size();
+	  return Error::DECRYPT_ERROR;
+	}
+
+      // only now that the packet is authenticated do we trust the packet ID
+      if (pid_out)
+	*pid_out = pid;
+      else if (!accept_packet_id(pid, now))
+	{
+	  buf.reset_size();
+	  return Error::REPLAY_ERROR;
+	}
+      return Error::SUCCESS;
+    }
+
+    bool verify_packet_id(BufferAllocated& buf, const PacketID::time_t now, PacketID *pid_out)
     {
+      if (pid_out)
+	{
+	  // defer the replay check to the caller
+	  pid_out->read(buf, PacketID::SHORT_FORM);
+	  return true;
+	}
+
       // ignore packet ID if pid_recv is not initialized
       if (pid_recv.initialized())
+	return accept_packet_id(pid_recv.read_next(buf), now);
+      return true;
+    }
+
+    // Buffers prepared by Frame already reserve enough tailroom to
+    // decrypt in place.  Anything else is copied once into a work
+    // buffer that does.
+    void ensure_tailroom(BufferAllocated& buf, const size_t tailroom)
+    {
+      if (buf.remaining() < tailroom)
 	{
-	  const PacketID pid = pid_recv.read_next(buf);
-	  if (pid_recv.test(pid, now)) // verify packet ID
-	    pid_recv.add(pid, now);    // remember packet ID
-	  else
-	    return false;
+	  Frame::count_realign();
+	  frame->prepare(Frame::DECRYPT_WORK, work);
+	  work.write(buf.c_data(), buf.size());
+	  buf.swap(work);
 	}
-      return true;
     }
 
+    DataCryptoPolicy::Type policy;
     BufferAllocated work;
   };
 
@@ -35,6 +35,8 @@
 #include <openvpn/crypto/hmac.hpp>
 #include <openvpn/crypto/static_key.hpp>
 #include <openvpn/crypto/packet_id.hpp>
+#include <openvpn/crypto/aead.hpp>
+#include <openvpn/crypto/datapolicy.hpp>
 
 namespace openvpn {
   template <typename RAND_API, typename CRYPTO_API>
@@ -42,71 +44,217 @@ namespace openvpn {
   public:
     OPENVPN_SIMPLE_EXCEPTION(unsupported_cipher_mode);
 
+    Encrypt() : policy(DataCryptoPolicy::GENERIC) {}
+
+    // call after keying cipher and hmac
+    void select_policy()
+    {
+      policy = DataCryptoPolicy::select(cipher, hmac);
+    }
+
     void encrypt(BufferAllocated& buf, const PacketID::time_t now)
+    {
+      encrypt_(buf, now, NULL, NULL);
+    }
+
+    // Encrypt using a packet ID drawn by the caller from another
+    // Encrypt object's pid_send.  This lets several Encrypt objects
+    // keyed alike, such as one per worker thread, share a single
+    // packet ID sequence.
+    void encrypt(BufferAllocated& buf, const PacketID& pid)
+    {
+      encrypt_(buf, pid.time, NULL, &pid);
+    }
+
+    // Encrypt a burst of n packets, such as everything drained from
+    // the tun device in one wakeup.  Only IV generation is batched: in
+    // CBC mode, the IVs for the whole burst are drawn from the PRNG in
+    // a single call.  The IV reset of the cipher, the HMAC and the
+    // packet ID are still done per packet.
+    void encrypt_burst(BufferAllocated *const *bufs, const size_t n, const PacketID::time_t now)
+    {
+      const unsigned char *ivs = NULL;
+      size_t iv_length = 0;
+      if (n > 1 && cipher.defined() && !cipher.is_aead())
+	{
+	  iv_length = cipher.iv_length();
+	  iv_burst.reset(n * iv_length, BufferAllocated::DESTRUCT_ZERO);
+	  prng->rand_bytes(iv_burst.data_raw(), n * iv_length);
+	  ivs = iv_burst.c_data_raw();
+	}
+      for (size_t i = 0; i < n; ++i)
+	encrypt_(*bufs[i], now, ivs ? ivs + i * iv_length : NULL, NULL);
+    }
+
+    Frame::Ptr frame;
+    CipherContext<CRYPTO_API> cipher;
+    HMACContext<CRYPTO_API> hmac;
+    PacketIDSend pid_send;
+    typename PRNG<RAND_API, CRYPTO_API>::Ptr prng;
+    AEADNonce nonce; // implicit IV portion set at key init time, AEAD mode only
+
+  private:
+    // iv is an optional pre-generated CBC IV of cipher.iv_length() bytes,
+    // pid an optional pre-assigned packet ID
+    void encrypt_(BufferAllocated& buf, const PacketID::time_t now,
+		  const unsigned char *iv, const PacketID *pid_arg)
     {
       // skip null packets
       if (!buf.size())
 	return;
 
-      if (cipher.defined())
+      switch (policy)
+	{
+	case DataCryptoPolicy::AEAD:
+	  encrypt_aead(buf, now, pid_arg);
+	  break;
+	case DataCryptoPolicy::CBC16_HMAC20:
+	  encrypt_cbc_hmac<16, 20>(buf, now, iv, pid_arg);
+	  break;
+	case DataCryptoPolicy::CBC16_HMAC32:
+	  encrypt_cbc_hmac<16, 32>(buf, now, iv, pid_arg);
+	  break;
+	case DataCryptoPolicy::CBC16_HMAC64:
+	  encrypt_cbc_hmac<16, 64>(buf, now, iv, pid_arg);
+	  break;
+	case DataCryptoPolicy::CBC8_HMAC20:
+	  encrypt_cbc_hmac<8, 20>(buf, now, iv, pid_arg);
+	  break;
+	default:
+	  encrypt_generic(buf, now, iv, pid_arg);
+	  break;
+	}
+    }
+
+    void encrypt_aead(BufferAllocated& buf, const PacketID::time_t now, const PacketID *pid_arg)
+    {
+      // AEAD mode: the packet ID goes out in the clear as part
+      // of the nonce and is authenticated as associated data
+      const PacketID pid = pid_arg ? *pid_arg : pid_send.next(now);
+      nonce.set_pid(pid);
+
+      // ciphertext is the same size as cleartext, so encrypt in place
+      const size_t tag_length = cipher.aead_tag_length();
+      ensure_room(buf, AEADNonce::PID_SIZE + tag_length, 0);
+      const size_t ct_size = buf.size();
+      unsigned char *tag = buf.prepend_alloc(tag_length);
+      unsigned char *ct = tag + tag_length;
+      if (!cipher.aead_encrypt(nonce.iv(), ct, ct_size, ct, ct_size,
+			       nonce.ad(), nonce.ad_size(), tag))
+	{
+	  buf.reset_size();
+	  return;
+	}
+
+      // prepend the packet ID
+      pid.write(buf, PacketID::SHORT_FORM, true);
+    }
+
+    // CBC cipher with an IV and block size of IV_LEN bytes,
+    // authenticated by an HMAC of HMAC_LEN bytes
+    template <size_t IV_LEN, size_t HMAC_LEN>
+    void encrypt_cbc_hmac(BufferAllocated& buf, const PacketID::time_t now,
+			  const unsigned char *iv, const PacketID *pid_arg)
+    {
+      unsigned char iv_buf[IV_LEN];
+
+      ensure_room(buf, PacketID::size(PacketID::SHORT_FORM) + IV_LEN + HMAC_LEN, IV_LEN);
+
+      // explicit, random IV
+      if (iv)
+	std::memcpy(iv_buf, iv, IV_LEN);
+      else
+	prng->rand_bytes(iv_buf, IV_LEN);
+
+      // generate fresh outgoing packet ID and prepend to cleartext buffer
+      write_pid(buf, now, pid_arg);
+
+      // encrypt buf in place
+      const size_t encrypt_bytes = cipher.encrypt(iv_buf, buf.data(), buf.max_size(), buf.c_data(), buf.size());
+      if (!encrypt_bytes)
+	{
+	  buf.reset_size();
+	  return;
+	}
+      buf.set_size(encrypt_bytes);
+
+      // prepend the IV to the ciphertext
+      std::memcpy(buf.prepend_alloc(IV_LEN), iv_buf, IV_LEN);
+
+      // HMAC the IV and ciphertext
+      const unsigned char *content = buf.data();
+      const size_t content_size = buf.size();
+      hmac.hmac(buf.prepend_alloc(HMAC_LEN), HMAC_LEN, content, content_size);
+    }
+
+    void encrypt_generic(BufferAllocated& buf, const PacketID::time_t now,
+			 const unsigned char *iv, const PacketID *pid_arg)
+    {
+      if (cipher.defined() && cipher.is_aead())
+	encrypt_aead(buf, now, pid_arg);
+      else if (cipher.defined())
 	{
 	  // workspace for generating IV
 	  unsigned char iv_buf[CRYPTO_API::CipherContext::MAX_IV_LENGTH];
 	  const size_t iv_length = cipher.iv_length();
 
+	  // make room in front for packet ID, IV and HMAC, and
+	  // behind for padding, so that we can encrypt in place
+	  ensure_room(buf,
+		      PacketID::size(PacketID::SHORT_FORM) + iv_length + (hmac.defined() ? hmac.output_size() : 0),
+		      cipher.block_size());
+
 	  // IV and packet ID are generated differently depending on cipher mode
 	  const int cipher_mode = cipher.cipher_mode();
 	  if (cipher_mode == CRYPTO_API::CipherContext::CIPH_CBC_MODE)
 	    {
 	      // in CBC mode, use an explicit, random IV
-	      prng->rand_bytes(iv_buf, iv_length);
+	      if (iv)
+		std::memcpy(iv_buf, iv, iv_length);
+	      else
+		prng->rand_bytes(iv_buf, iv_length);
 
 	      // generate fresh outgoing packet ID and prepend to cleartext buffer
-	      pid_send.write_next(buf, true, now);
+	      write_pid(buf, now, pid_arg);
 	    }
 	  else
 	    {
 	      throw unsupported_cipher_mode();
 	    }
 
-	  // initialize work buffer
-	  frame->prepare(Frame::ENCRYPT_WORK, work);
-
-	  // encrypt from buf -> work
-	  const size_t encrypt_bytes = cipher.encrypt(iv_buf, work.data(), work.max_size(), buf.c_data(), buf.size());
+	  // encrypt buf in place
+	  const size_t encrypt_bytes = cipher.encrypt(iv_buf, buf.data(), buf.max_size(), buf.c_data(), buf.size());
 	  if (!encrypt_bytes)
 	    {
 	      buf.reset_size();
 	      return;
 	    }
-	  work.set_size(encrypt_bytes);
+	  buf.set_size(encrypt_bytes);
 
 	  // prepend the IV to the ciphertext
-	  work.prepend(iv_buf, iv_length);
+	  buf.prepend(iv_buf, iv_length);
 
 	  // HMAC the ciphertext
-	  prepend_hmac(work);
-
-	  // return ciphertext result in buf
-	  buf.swap(work);
+	  prepend_hmac(buf);
 	}
       else // no encryption
 	{
 	  // generate fresh outgoing packet ID and prepend to cleartext buffer
-	  pid_send.write_next(buf, true, now);
+	  write_pid(buf, now, pid_arg);
 
 	  // HMAC the cleartext
 	  prepend_hmac(buf);
 	}
     }
 
-    Frame::Ptr frame;
-    CipherContext<CRYPTO_API> cipher;
-    HMACContext<CRYPTO_API> hmac;
-    PacketIDSend pid_send;
-    typename PRNG<RAND_API, CRYPTO_API>::Ptr prng;
+    void write_pid(BufferAllocated& buf, const PacketID::time_t now, const PacketID *pid)
+    {
+      if (pid)
+	pid->write(buf, PacketID::SHORT_FORM, true);
+      else
+	pid_send.write_next(buf, true, now);
+    }
 
-  private:
     // compute HMAC signature of data buffer,
     // then prepend the signature to the buffer.
     void prepend_hmac(BufferAllocated& buf)
@@ -121,7 +269,23 @@ namespace openvpn {
 	}
     }
 
+    // Buffers prepared by Frame already reserve enough headroom and
+    // tailroom to encrypt in place.  Anything else is copied once
+    // into a work buffer that does.
+    void ensure_room(BufferAllocated& buf, const size_t headroom, const size_t tailroom)
+    {
+      if (buf.offset() < headroom || buf.remaining() < tailroom)
+	{
+	  Frame::count_realign();
+	  frame->prepare(Frame::ENCRYPT_WORK, work);
+	  work.write(buf.c_data(), buf.size());
+	  buf.swap(work);
+	}
+    }
+
+    DataCryptoPolicy::Type policy;
     BufferAllocated work;
+    BufferAllocated iv_burst;
   };
 
 } // namespace openvpn
@@ -26,13 +26,15 @@
 
 #include <string>
 #include <sstream>
+#include <vector>
+#include <deque>
+#include <algorithm>
 
-#include <boost/cstdint.hpp> // for boost::uint32_t
+#include <boost/cstdint.hpp> // for boost::uint32_t, boost::uint64_t
 #include <boost/asio.hpp>
 
 #include <openvpn/common/types.hpp>
 #include <openvpn/common/exception.hpp>
-#include <openvpn/common/circ_list.hpp>
 #include <openvpn/common/socktypes.hpp>
 #include <openvpn/time/time.hpp>
 #include <openvpn/buffer/buffer.hpp>
@@ -223,6 +225,10 @@ namespace openvpn {
    * This is the data structure we keep on the receiving side,
    * to check that no packet-id (i.e. sequence number + optional timestamp)
    * is accepted more than once.
+   *
+   * In UDP mode, received sequence numbers are tracked in a sliding
+   * window of seq_backtrack bits, packed into 64-bit words.  Bit
+   * (id & window_mask_) is set once packet id has been accepted.
    */
   class PacketIDReceive
   {
@@ -252,26 +258,6 @@ namespace openvpn {
       DEFAULT_TIME_BACKTRACK = 15
     };
 
-    /*
-     * Special PacketID::time_t value that indicates that
-     * sequence number has expired.
-     */
-    enum {
-      SEQ_UNSEEN = 0,
-      SEQ_EXPIRED = 1
-    };
-
-    /*
-     * Do a reap pass through the sequence number
-     * array once every n seconds in order to
-     * expire sequence numbers which can no longer
-     * be accepted because they would violate
-     * TIME_BACKTRACK.
-     */
-    enum {
-      SEQ_REAP_PERIOD = 5
-    };
-
     /* mode */
     enum {
       UDP_MODE = 0,
@@ -291,13 +277,17 @@ namespace openvpn {
       form_ = form;
       id_ = 0;
       time_ = 0;
-      last_reap_ = 0;
+      base_ = 0;
+      expire_floor_ = 0;
       seq_backtrack_ = 0;
       max_backtrack_stat_ = 0;
       time_backtrack_ = 0;
+      window_mask_ = 0;
       name_ = name;
       unit_ = unit;
       stats = stats_arg;
+      window_.clear();
+      checkpoints_.clear();
       if (seq_backtrack && mode == UDP_MODE)
 	{
 	  if (MIN_SEQ_BACKTRACK <= seq_backtrack
@@ -307,13 +297,17 @@ namespace openvpn {
 	    {
 	      seq_backtrack_ = seq_backtrack;
 	      time_backtrack_ = time_backtrack;
-	      seq_list_.init(seq_backtrack);
+
+	      // round window up to a power of 2 number of 64-bit words
+	      size_t n_bits = WORD_BITS;
+	      while (n_bits < size_t(seq_backtrack))
+		n_bits <<= 1;
+	      window_.resize(n_bits / WORD_BITS, 0);
+	      window_mask_ = PacketID::id_t(n_bits - 1);
 	    }
 	  else
 	    throw packet_id_backtrack_out_of_range();
 	}
-      else
-	seq_list_.init(0);
       initialized_ = true;
     }
 
@@ -327,10 +321,6 @@ namespace openvpn {
       if (!initialized_)
 	throw packet_id_not_initialized();
 
-      // see if we should do an expiration reap pass
-      if (last_reap_ + SEQ_REAP_PERIOD <= now)
-	reap(now);
-
       // test for invalid packet ID
       if (!pin.is_valid())
 	{
@@ -338,7 +328,7 @@ namespace openvpn {
 	  return false;
 	}
 
-      if (seq_list_.defined())
+      if (window_defined())
 	{
 	  /*
 	   * In backtrack mode, we allow packet reordering subject
@@ -362,22 +352,20 @@ namespace openvpn {
 		  debug_log (Error::PKTID_UDP_REPLAY_WINDOW_BACKTRACK, pin, "UDP replay-window backtrack occurred", max_backtrack_stat_, now);
 		}
 
-	      if (diff >= seq_list_.size())
+	      if (diff >= window_size())
 		{
 		  debug_log (Error::PKTID_UDP_LARGE_DIFF, pin, "UDP large diff", diff, now);
 		  return false;
 		}
 
-	      {
-		const PacketID::time_t v = seq_list_[diff];
-		if (v == PacketID::time_t(SEQ_UNSEEN))
-		  return true;
-		else
-		  {
-		    debug_log (Error::PKTID_UDP_REPLAY, pin, "UDP replay", diff, now);
-		    return false;
-		  }
-	      }
+	      /* packets older than time_backtrack seconds count as replays */
+	      expire(now);
+	      if (pin.id <= expire_floor_ || window_test(pin.id))
+		{
+		  debug_log (Error::PKTID_UDP_REPLAY, pin, "UDP replay", diff, now);
+		  return false;
+		}
+	      return true;
 	    }
 	  else if (pin.time < time_) /* if time goes back, reject */
 	    {
@@ -428,10 +416,10 @@ namespace openvpn {
     {
       if (!initialized_)
 	throw packet_id_not_initialized();
-      if (seq_list_.defined())
+      if (window_defined())
 	{
 	  // UDP mode.  Decide if we should reset sequence number history list.
-	  if (!seq_list_.size()            // indicates first pass
+	  if (id_ == base_                 // indicates first pass
 	      || pin.time > time_          // if time value increases, must reset
 	      || (pin.id >= seq_backtrack_ // also, big jumps in pin.id require us to reset
 		  && pin.id - seq_backtrack_ > id_))
@@ -440,21 +428,40 @@ namespace openvpn {
 	      id_ = 0;
 	      if (pin.id > seq_backtrack_) // if pin.id is large, fast-forward
 		id_ = pin.id - seq_backtrack_;
-	      seq_list_.reset();
+	      base_ = id_;
+	      expire_floor_ = 0;
+	      checkpoints_.clear();
+	      std::fill(window_.begin(), window_.end(), Word(0));
 	    }
 
-	  while (id_ < pin.id) // should never iterate more than seq_backtrack_ steps
+	  // slide window forward, clearing bits of sequence numbers
+	  // that are newly entering it
+	  if (pin.id > id_)
 	    {
-	      seq_list_.push(PacketID::time_t(SEQ_UNSEEN));
-	      ++id_;
+	      const PacketID::id_t delta = pin.id - id_;
+	      if (delta > window_mask_)
+		std::fill(window_.begin(), window_.end(), Word(0));
+	      else
+		for (PacketID::id_t i = id_ + 1; i != pin.id; ++i)
+		  window_clear(i);
+	      id_ = pin.id;
 	    }
 
-	  // remember timestamp of packet ID
-	  {
-	    const size_t diff = id_ - pin.id;
-	    if (diff < seq_list_.size() && now > PacketID::time_t(SEQ_EXPIRED))
-	      seq_list_[diff] = now;
-	  }
+	  // remember packet ID
+	  if (id_ - pin.id < window_size())
+	    window_set(pin.id);
+
+	  // remember highest packet ID seen as of now, for time_backtrack,
+	  // dropping checkpoints that have aged out so that at most
+	  // time_backtrack_+1 of them are kept
+	  if (time_backtrack_)
+	    {
+	      expire(now);
+	      if (!checkpoints_.empty() && checkpoints_.back().time == now)
+		checkpoints_.back().id = id_;
+	      else
+		checkpoints_.push_back(Checkpoint(now, id_));
+	    }
 	}
       else
 	{
@@ -480,24 +487,17 @@ namespace openvpn {
 	throw packet_id_not_initialized();
       std::ostringstream os;
       os << name_ << "-" << unit_ << " [";
-      for (size_t i = 0; i < seq_list_.size(); ++i)
+      const size_t size = window_size();
+      for (size_t i = 0; i < size; ++i)
 	{
+	  const PacketID::id_t id = id_ - PacketID::id_t(i);
 	  char c;
-	  const PacketID::time_t v = seq_list_[i];
-	  if (v == PacketID::time_t(SEQ_UNSEEN))
-	    c = '_';
-	  else if (v == PacketID::time_t(SEQ_EXPIRED))
+	  if (id <= expire_floor_)
 	    c = 'E';
+	  else if (window_test(id))
+	    c = 'X';
 	  else
-	    {
-	      const int diff = int(now - v);
-	      if (diff < 0)
-		c = 'N';
-	      else if (diff < 10)
-		c = '0' + diff;
-	      else
-		c = '>';
-	    }
+	    c = '_';
 	  os << c;
 	}
       os << "] " << time_ << ":" << id_;
@@ -506,28 +506,64 @@ namespace openvpn {
 #endif
 
   private:
+    typedef boost::uint64_t Word;
+
+    enum {
+      WORD_BITS = 64,
+      WORD_SHIFT = 6
+    };
+
+    // highest sequence number accepted as of a given second
+    struct Checkpoint
+    {
+      Checkpoint(const PacketID::time_t time_arg, const PacketID::id_t id_arg)
+	: time(time_arg), id(id_arg) {}
+
+      PacketID::time_t time;
+      PacketID::id_t id;
+    };
+
+    bool window_defined() const { return !window_.empty(); }
+
+    // number of sequence numbers below and including id_ that
+    // are currently tracked by the window
+    size_t window_size() const
+    {
+      return std::min(size_t(id_ - base_), size_t(seq_backtrack_));
+    }
+
+    bool window_test(const PacketID::id_t id) const
+    {
+      const PacketID::id_t bit = id & window_mask_;
+      return (window_[bit >> WORD_SHIFT] >> (bit & (WORD_BITS-1))) & 1;
+    }
+
+    void window_set(const PacketID::id_t id)
+    {
+      const PacketID::id_t bit = id & window_mask_;
+      window_[bit >> WORD_SHIFT] |= Word(1) << (bit & (WORD_BITS-1));
+    }
+
+    void window_clear(const PacketID::id_t id)
+    {
+      const PacketID::id_t bit = id & window_mask_;
+      window_[bit >> WORD_SHIFT] &= ~(Word(1) << (bit & (WORD_BITS-1)));
+    }
+
     /*
      * Expire sequence numbers which can no longer
      * be accepted because they would violate
-     * time_backtrack.
+     * time_backtrack.  Anything at or below the highest
+     * sequence number seen more than time_backtrack
+     * seconds ago is treated as a replay.
      */
-    void reap(const PacketID::time_t now)
+    void expire(const PacketID::time_t now)
     {
-      if (time_backtrack_)
+      while (!checkpoints_.empty() && checkpoints_.front().time + time_backtrack_ < now)
 	{
-	  bool expire = false;
-	  for (size_t i = 0; i < seq_list_.size(); ++i)
-	    {
-	      const PacketID::time_t t = seq_list_[i];
-	      if (t == PacketID::time_t(SEQ_EXPIRED)) // fast path -- once we see SEQ_EXPIRED from previous run, we can stop
-		break;
-	      if (!expire && t && t + time_backtrack_ < now)
-		expire = true;
-	      if (expire)
-		seq_list_[i] = PacketID::time_t(SEQ_EXPIRED);
-	    }
+	  expire_floor_ = checkpoints_.front().id;
+	  checkpoints_.pop_front();
 	}
-      last_reap_ = now;
     }
 
     void debug_log (const Error::Type err_type, const PacketID& pin, const char *description, const PacketID::id_t info, const PacketID::time_t now) const
@@ -555,15 +591,18 @@ namespace openvpn {
     bool initialized_;                     /* true if packet_id_init was called */
     PacketID::id_t id_;                    /* highest sequence number received */
     PacketID::time_t time_;                /* highest time stamp received */
-    PacketID::time_t last_reap_;           /* last call of packet_id_reap */
+    PacketID::id_t base_;                  /* sequence numbers <= base_ fall outside window */
+    PacketID::id_t expire_floor_;          /* sequence numbers <= expire_floor_ have expired */
     PacketID::id_t seq_backtrack_;         /* maximum allowed packet ID backtrack (init parameter) */
     PacketID::id_t max_backtrack_stat_;    /* maximum backtrack seen so far */
+    PacketID::id_t window_mask_;           /* window size in bits - 1 */
     int time_backtrack_;                   /* maximum allowed time backtrack (init parameter) */
     std::string name_;                     /* name of this object (for debugging) */
     int unit_;                             /* unit number of this object (for debugging) */
     int form_;                             /* PacketID::LONG_FORM or PacketID::SHORT_FORM */
     SessionStats::Ptr stats;               /* used for error logging */
-    CircList<PacketID::time_t> seq_list_;  /* packet-id "memory" */
+    std::vector<Word> window_;             /* packet-id "memory", one bit per sequence number */
+    std::deque<Checkpoint> checkpoints_;   /* for time_backtrack expiry */
   };
 
 } // namespace openvpn
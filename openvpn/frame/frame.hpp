@@ -30,6 +30,10 @@
 #include <openvpn/common/rc.hpp>
 #include <openvpn/buffer/buffer.hpp>
 
+#ifdef OPENVPN_DEBUG_FRAME
+#include <boost/atomic.hpp>
+#endif
+
 namespace openvpn {
 
   class Frame : public RC<thread_unsafe_refcount>
@@ -54,6 +58,8 @@ namespace openvpn {
       WRITE_ACK_STANDALONE,
       WRITE_DC_MSG,
       WRITE_HTTP_PROXY,
+      READ_LINK_UDP_GRO,
+      READ_TUN_VNET,
       N_ALIGN_CONTEXTS
     };
 
@@ -110,7 +116,12 @@ namespace openvpn {
       // Realign a buffer to headroom
       void realign(Buffer& buf) const
       {
-	buf.realign(actual_headroom(buf.c_data_raw()));
+	const size_t headroom = actual_headroom(buf.c_data_raw());
+	if (buf.offset() != headroom)
+	  {
+	    count_realign();
+	    buf.realign(headroom);
+	  }
       }
 
       // Return a new BufferAllocated object initialized with the given data
@@ -132,6 +143,23 @@ namespace openvpn {
 	  return 0;
       }
 
+      // Change headroom and tailroom, keeping payload and alignment.
+      // Capacity is recalculated, so the context may need to be
+      // standardized again.
+      void set_room(const size_t headroom, const size_t tailroom)
+      {
+	headroom_ = headroom;
+	tailroom_ = tailroom;
+	recalc_derived();
+      }
+
+      // Change payload, keeping headroom, tailroom and alignment.
+      void set_payload(const size_t payload)
+      {
+	payload_ = payload;
+	recalc_derived();
+      }
+
       // Used to set the capacity of a group of Context objects
       // to the highest capacity of any one of the members.
       void standardize_capacity(const size_t newcap)
@@ -255,7 +283,34 @@ namespace openvpn {
 	}
     }
 
+    // Count buffers that had to be realigned or copied because a
+    // context lacked headroom or tailroom.  Only counted when
+    // OPENVPN_DEBUG_FRAME is defined.
+    static void count_realign()
+    {
+#ifdef OPENVPN_DEBUG_FRAME
+      realign_counter().fetch_add(1, boost::memory_order_relaxed);
+#endif
+    }
+
+    static count_t realign_count()
+    {
+#ifdef OPENVPN_DEBUG_FRAME
+      return realign_counter().load(boost::memory_order_relaxed);
+#else
+      return 0;
+#endif
+    }
+
   private:
+#ifdef OPENVPN_DEBUG_FRAME
+    static boost::atomic<count_t>& realign_counter()
+    {
+      static boost::atomic<count_t> count(0);
+      return count;
+    }
+#endif
+
     Context contexts[N_ALIGN_CONTEXTS];
   };
 
@@ -26,12 +26,18 @@
 
 #include <openvpn/frame/frame.hpp>
 
+#ifdef OPENVPN_BUFFER_SLAB
+#include <openvpn/buffer/slab.hpp>
+#endif
+
 namespace openvpn {
 
   inline Frame::Ptr frame_init()
   {
     const size_t payload = 2048;
     const size_t control_channel_payload = 1350;
+    const size_t udp_gro_payload = 65536; // largest UDP_GRO coalesced datagram
+    const size_t tun_vnet_payload = 65536 + 16; // largest tun TSO/GSO packet plus virtio_net_hdr
     const size_t headroom = 512;
     const size_t tailroom = 512;
     const size_t align_block = 16;
@@ -42,9 +48,54 @@ namespace openvpn {
     (*frame)[Frame::READ_LINK_UDP] = Frame::Context(headroom, payload, tailroom, 1, align_block, buffer_flags);
     (*frame)[Frame::READ_BIO_MEMQ_STREAM] = Frame::Context(headroom, control_channel_payload, tailroom, 0, align_block, buffer_flags);
     frame->standardize_capacity(~0);
+
+#ifdef OPENVPN_BUFFER_SLAB
+    // per-packet buffers now share one capacity, so pool it
+    BufferSlab::add_class((*frame)[Frame::READ_LINK_UDP].capacity());
+#endif
+
+    // sized for the aggregate, so kept out of the standardized group above
+    (*frame)[Frame::READ_LINK_UDP_GRO] = Frame::Context(0, udp_gro_payload, 0, 0, align_block, buffer_flags);
+    (*frame)[Frame::READ_TUN_VNET] = Frame::Context(0, tun_vnet_payload, 0, 0, align_block, buffer_flags);
     return frame;
   }
 
+  // Size the contexts that carry data channel packets for the options in
+  // use, so that no stage between tun and transport needs to realign or
+  // copy a buffer.  headroom is the most that the data channel prepends
+  // to a tun packet (compression byte, packet ID, IV, HMAC or AEAD tag,
+  // op byte and TCP length prefix) and tailroom the most that it appends
+  // (compression swap byte and CBC padding).  Packets on their way to tun
+  // additionally need room for the tun prefix or virtio_net_hdr.
+  // control_payload is the most SSL ciphertext that fits in one control
+  // channel packet, and sizes the buffers that the SSL object writes
+  // ciphertext to, so that each becomes one full-size packet.
+  inline void frame_plan(Frame& frame, const size_t headroom, const size_t tailroom,
+			 const size_t control_payload)
+  {
+    const size_t tun_headroom = 16;
+    static const unsigned int data_contexts[] = {
+      Frame::ENCRYPT_WORK,
+      Frame::DECRYPT_WORK,
+      Frame::COMPRESS_WORK,
+      Frame::DECOMPRESS_WORK,
+      Frame::READ_LINK_UDP,
+      Frame::READ_LINK_TCP,
+      Frame::READ_TUN,
+      Frame::READ_TUN_VNET,
+    };
+
+    for (size_t i = 0; i < sizeof(data_contexts) / sizeof(data_contexts[0]); ++i)
+      frame[data_contexts[i]].set_room(headroom + tun_headroom, tailroom);
+    frame[Frame::READ_BIO_MEMQ_STREAM].set_payload(control_payload);
+    // READ_TUN_VNET keeps its own, larger capacity
+    frame.standardize_capacity(~((1 << Frame::READ_LINK_UDP_GRO) | (1 << Frame::READ_TUN_VNET)));
+
+#ifdef OPENVPN_BUFFER_SLAB
+    BufferSlab::add_class(frame[Frame::READ_LINK_UDP].capacity());
+#endif
+  }
+
 } // namespace openvpn
 
 #endif // OPENVPN_FRAME_FRAME_INIT_H
@@ -0,0 +1,79 @@
+//    OpenVPN -- An application to securely tunnel IP networks
+//               over a single port, with support for SSL/TLS-based
+//               session authentication and key exchange,
+//               packet encryption, packet authentication, and
+//               packet compression.
+//
+//    Copyright (C) 2013 OpenVPN Technologies, Inc.
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Affero General Public License Version 3
+//    as published by the Free Software Foundation.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Affero General Public License for more details.
+//
+//    You should have received a copy of the GNU Affero General Public License
+//    along with this program in the COPYING file.
+//    If not, see <http://www.gnu.org/licenses/>.
+
+// Internet checksum (RFC 1071) over data in network byte order.
+
+#ifndef OPENVPN_IP_CSUM_H
+#define OPENVPN_IP_CSUM_H
+
+#include <cstddef>           // for size_t
+#include <boost/cstdint.hpp> // for boost::uint32_t, uint16_t
+
+namespace openvpn {
+  namespace IPChecksum {
+
+    // Add data to a running one's complement sum of 16-bit words.
+    // An odd trailing byte is padded with zero, so only the last
+    // block added to a sum may have odd length.  The sum can't
+    // overflow for the amount of data in a single IP packet.
+    inline boost::uint32_t add(boost::uint32_t sum, const unsigned char *data, size_t len)
+    {
+      while (len > 1)
+	{
+	  sum += (boost::uint32_t(data[0]) << 8) | data[1];
+	  data += 2;
+	  len -= 2;
+	}
+      if (len)
+	sum += boost::uint32_t(data[0]) << 8;
+      return sum;
+    }
+
+    // fold a running sum into a 16-bit one's complement sum
+    inline boost::uint16_t fold(boost::uint32_t sum)
+    {
+      while (sum >> 16)
+	sum = (sum & 0xFFFF) + (sum >> 16);
+      return boost::uint16_t(sum);
+    }
+
+    // finish a running sum, returning the checksum in host byte order
+    inline boost::uint16_t finish(const boost::uint32_t sum)
+    {
+      return boost::uint16_t(~fold(sum));
+    }
+
+    // checksum of data, in host byte order
+    inline boost::uint16_t checksum(const unsigned char *data, const size_t len)
+    {
+      return finish(add(0, data, len));
+    }
+
+    // store a host byte order checksum at p in network byte order
+    inline void store(unsigned char *p, const boost::uint16_t csum)
+    {
+      p[0] = (unsigned char)(csum >> 8);
+      p[1] = (unsigned char)(csum & 0xFF);
+    }
+  }
+} // namespace openvpn
+
+#endif // OPENVPN_IP_CSUM_H
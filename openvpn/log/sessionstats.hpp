@@ -20,17 +20,33 @@
 //    If not, see <http://www.gnu.org/licenses/>.
 
 // A class that handles statistics tracking in an OpenVPN session
+//
+// Counters are kept in shards, one per thread that updates them, each
+// on its own cache lines, so that threads don't contend for the same
+// line and updates need no locked instructions.  Reads add up the
+// shards.  A shard is only written by the thread that owns it, which
+// brackets each update with a sequence count so that snapshot can copy
+// a shard in a state between updates.  Threads beyond the first
+// N_SHARDS share one more shard that is updated with atomic adds.
 
 #ifndef OPENVPN_LOG_SESSIONSTATS_H
 #define OPENVPN_LOG_SESSIONSTATS_H
 
 #include <cstring>
+#include <new>
+
+#include <boost/atomic.hpp>
 
 #include <openvpn/common/types.hpp>
 #include <openvpn/common/rc.hpp>
+#include <openvpn/common/thread.hpp>
 #include <openvpn/error/error.hpp>
 #include <openvpn/time/time.hpp>
 
+#if OPENVPN_MULTITHREAD
+#include <boost/thread/tss.hpp>
+#endif
+
 namespace openvpn {
 
   class SessionStats : public RC<thread_safe_refcount>
@@ -51,10 +67,30 @@ namespace openvpn {
       N_STATS,
     };
 
+    enum {
+      N_SHARDS = 4,     // shards owned by a single thread
+      CACHE_LINE = 64,
+    };
+
+    // all counters, as of a single point between updates of each shard
+    struct Snapshot
+    {
+      count_t stats[N_STATS];
+      count_t errors[Error::N_ERRORS];
+    };
+
     SessionStats()
       : verbose_(false)
     {
-      std::memset(stats_, 0, sizeof(stats_));
+      shards_raw = new unsigned char[sizeof(Shard) * (N_SHARDS + 1) + CACHE_LINE];
+      shards = reinterpret_cast<Shard*>(shards_raw + (-size_t(shards_raw) & (CACHE_LINE - 1)));
+      for (size_t i = 0; i <= N_SHARDS; ++i)
+	new (&shards[i]) Shard();
+    }
+
+    virtual ~SessionStats()
+    {
+      delete [] shards_raw;
     }
 
     virtual void error(const size_t type, const std::string* text=NULL) = 0;
@@ -66,20 +102,51 @@ namespace openvpn {
     void inc_stat(const size_t type, const count_t value)
     {
       if (type < N_STATS)
-	stats_[type] += value;
+	{
+	  const size_t slot = thread_slot();
+	  add(slot, shards[slot].stats[type], value);
+	}
     }
 
     count_t get_stat(const size_t type) const
     {
       if (type < N_STATS)
-	return stats_[type];
+	return get_stat_fast(type);
       else
 	return 0;
     }
 
     count_t get_stat_fast(const size_t type) const
     {
-      return stats_[type];
+      count_t ret = 0;
+      for (size_t i = 0; i <= N_SHARDS; ++i)
+	ret += shards[i].stats[type].load(boost::memory_order_relaxed);
+      return ret;
+    }
+
+    // error counts, for subclasses that count errors with count_error
+    count_t get_error(const size_t type) const
+    {
+      count_t ret = 0;
+      if (type < Error::N_ERRORS)
+	for (size_t i = 0; i <= N_SHARDS; ++i)
+	  ret += shards[i].errors[type].load(boost::memory_order_relaxed);
+      return ret;
+    }
+
+    // May be called from any thread.
+    void snapshot(Snapshot& snap) const
+    {
+      std::memset(&snap, 0, sizeof(snap));
+      for (size_t i = 0; i <= N_SHARDS; ++i)
+	{
+	  Snapshot part;
+	  shards[i].read(part, i < N_SHARDS);
+	  for (size_t j = 0; j < N_STATS; ++j)
+	    snap.stats[j] += part.stats[j];
+	  for (size_t j = 0; j < Error::N_ERRORS; ++j)
+	    snap.errors[j] += part.errors[j];
+	}
     }
 
     static const char *stat_name(const size_t type)
@@ -111,10 +178,129 @@ namespace openvpn {
   protected:
     void session_stats_set_verbose(const bool v) { verbose_ = v; }
 
+    // subclasses may call here from error() to keep error counts
+    // alongside the stats
+    void count_error(const size_t type)
+    {
+      if (type < Error::N_ERRORS)
+	{
+	  const size_t slot = thread_slot();
+	  add(slot, shards[slot].errors[type], 1);
+	}
+    }
+
   private:
+    struct Counters
+    {
+      boost::atomic<unsigned int> seq; // odd while owner is updating
+      boost::atomic<count_t> stats[N_STATS];
+      boost::atomic<count_t> errors[Error::N_ERRORS];
+    };
+
+    struct Shard : public Counters
+    {
+      Shard()
+      {
+	seq.store(0, boost::memory_order_relaxed);
+	for (size_t i = 0; i < N_STATS; ++i)
+	  stats[i].store(0, boost::memory_order_relaxed);
+	for (size_t i = 0; i < Error::N_ERRORS; ++i)
+	  errors[i].store(0, boost::memory_order_relaxed);
+      }
+
+      // copy the counters, retrying while the owner is mid-update
+      void read(Snapshot& snap, const bool owned) const
+      {
+	unsigned int s;
+	do {
+	  s = seq.load(boost::memory_order_acquire);
+	  for (size_t i = 0; i < N_STATS; ++i)
+	    snap.stats[i] = stats[i].load(boost::memory_order_relaxed);
+	  for (size_t i = 0; i < Error::N_ERRORS; ++i)
+	    snap.errors[i] = errors[i].load(boost::memory_order_relaxed);
+	  boost::atomic_thread_fence(boost::memory_order_acquire);
+	} while (owned && ((s & 1) || s != seq.load(boost::memory_order_relaxed)));
+      }
+
+      // keep neighbouring shards off our cache lines
+      char pad[CACHE_LINE - sizeof(Counters) % CACHE_LINE];
+    };
+
+    // Returns the shard of the calling thread.  Each thread claims a
+    // free slot on first use and gives it back when it exits.  Slots
+    // are process-wide, so a thread uses the same one for every
+    // SessionStats object.
+    static size_t thread_slot()
+    {
+#if OPENVPN_MULTITHREAD
+      static boost::thread_specific_ptr<ThreadSlot> tss;
+      ThreadSlot* ts = tss.get();
+      if (!ts)
+	{
+	  ts = new ThreadSlot();
+	  tss.reset(ts);
+	}
+      return ts->index;
+#else
+      return 0;
+#endif
+    }
+
+    struct ThreadSlot
+    {
+      ThreadSlot() : index(N_SHARDS)
+      {
+	boost::atomic<unsigned int>& u = used();
+	unsigned int mask = u.load(boost::memory_order_relaxed);
+	for (size_t i = 0; i < N_SHARDS; ++i)
+	  {
+	    const unsigned int bit = 1u << i;
+	    while (!(mask & bit))
+	      {
+		if (u.compare_exchange_weak(mask, mask | bit, boost::memory_order_acquire))
+		  {
+		    index = i;
+		    return;
+		  }
+	      }
+	  }
+      }
+
+      ~ThreadSlot()
+      {
+	if (index < N_SHARDS)
+	  used().fetch_and(~(1u << index), boost::memory_order_release);
+      }
+
+      static boost::atomic<unsigned int>& used()
+      {
+	static boost::atomic<unsigned int> u(0);
+	return u;
+      }
+
+      size_t index;
+    };
+
+    void add(const size_t slot, boost::atomic<count_t>& c, const count_t value)
+    {
+      if (slot < N_SHARDS)
+	{
+	  // only this thread writes to the shard, so no locked add needed
+	  boost::atomic<unsigned int>& seq = shards[slot].seq;
+	  const unsigned int s = seq.load(boost::memory_order_relaxed);
+	  seq.store(s + 1, boost::memory_order_relaxed);
+	  boost::atomic_thread_fence(boost::memory_order_release);
+	  c.store(c.load(boost::memory_order_relaxed) + value, boost::memory_order_relaxed);
+	  seq.store(s + 2, boost::memory_order_release);
+	}
+      else
+	c.fetch_add(value, boost::memory_order_relaxed);
+    }
+
     bool verbose_;
     Time last_packet_received_;
-    count_t stats_[N_STATS];
+    unsigned char *shards_raw;
+    Shard *shards; // N_SHARDS owned shards plus one shared shard
   };
 
 } // namespace openvpn
@@ -89,6 +89,17 @@ namespace openvpn {
 
       bool defined() const { return cipher_ != NULL; }
 
+      // true for AEAD ciphers such as AES-GCM
+      bool is_aead() const
+      {
+	check_initialized();
+#ifdef EVP_CIPH_FLAG_AEAD_CIPHER
+	return (EVP_CIPHER_flags (cipher_) & EVP_CIPH_FLAG_AEAD_CIPHER) != 0;
+#else
+	return false;
+#endif
+      }
+
     private:
       const EVP_CIPHER *get() const
       {
@@ -124,7 +135,13 @@ namespace openvpn {
       // OpenSSL cipher constants
       enum {
 	MAX_IV_LENGTH = EVP_MAX_IV_LENGTH,
-	CIPH_CBC_MODE = EVP_CIPH_CBC_MODE
+	CIPH_CBC_MODE = EVP_CIPH_CBC_MODE,
+	AEAD_TAG_LENGTH = 16,
+#ifdef EVP_CIPH_FLAG_AEAD_CIPHER
+	SUPPORTS_AEAD = 1
+#else
+	SUPPORTS_AEAD = 0
+#endif
       };
 
       CipherContext()
@@ -214,6 +231,57 @@ namespace openvpn {
 	return EVP_CIPHER_CTX_mode (&ctx);  
       }
 
+      // return true if cipher is an AEAD cipher such as AES-GCM
+      bool is_aead() const
+      {
+	check_initialized();
+#ifdef EVP_CIPH_FLAG_AEAD_CIPHER
+	return (EVP_CIPHER_CTX_flags (&ctx) & EVP_CIPH_FLAG_AEAD_CIPHER) != 0;
+#else
+	return false;
+#endif
+      }
+
+      // Single-pass AEAD encrypt of in -> out (length bytes each),
+      // authenticating ad and writing an AEAD_TAG_LENGTH byte tag.
+      bool aead_encrypt(const unsigned char *iv,
+			unsigned char *out, const unsigned char *in, const size_t length,
+			const unsigned char *ad, const size_t ad_len,
+			unsigned char *tag)
+      {
+#ifdef EVP_CIPH_FLAG_AEAD_CIPHER
+	int outlen, finlen;
+	reset(iv);
+	if (EVP_CipherUpdate (&ctx, NULL, &outlen, ad, int(ad_len))
+	    && EVP_CipherUpdate (&ctx, out, &outlen, in, int(length))
+	    && EVP_CipherFinal_ex (&ctx, out + outlen, &finlen)
+	    && EVP_CIPHER_CTX_ctrl (&ctx, EVP_CTRL_GCM_GET_TAG, AEAD_TAG_LENGTH, tag))
+	  return true;
+	openssl_clear_error_stack();
+#endif
+	return false;
+      }
+
+      // Single-pass AEAD decrypt of in -> out (length bytes each).
+      // Returns false if tag does not authenticate ciphertext and ad.
+      bool aead_decrypt(const unsigned char *iv,
+			unsigned char *out, const unsigned char *in, const size_t length,
+			const unsigned char *ad, const size_t ad_len,
+			const unsigned char *tag)
+      {
+#ifdef EVP_CIPH_FLAG_AEAD_CIPHER
+	int outlen, finlen;
+	reset(iv);
+	if (EVP_CIPHER_CTX_ctrl (&ctx, EVP_CTRL_GCM_SET_TAG, AEAD_TAG_LENGTH, (void *)tag)
+	    && EVP_CipherUpdate (&ctx, NULL, &outlen, ad, int(ad_len))
+	    && EVP_CipherUpdate (&ctx, out, &outlen, in, int(length))
+	    && EVP_CipherFinal_ex (&ctx, out + outlen, &finlen))
+	  return true;
+	openssl_clear_error_stack();
+#endif
+	return false;
+      }
+
     private:
       void erase()
       {
@@ -74,6 +74,8 @@ namespace openvpn {
 	initialized = true;
       }
 
+      // With no key, HMAC_Init_ex copies back the keyed inner state
+      // that init saved, so the ipad block isn't hashed again.
       void reset()
       {
 	check_initialized();
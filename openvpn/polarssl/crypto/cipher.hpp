@@ -28,6 +28,9 @@
 #include <string>
 
 #include <polarssl/cipher.h>
+#include <polarssl/gcm.h>
+
+#include <cstring>
 
 #include <boost/noncopyable.hpp>
 #include <boost/algorithm/string.hpp> // for boost::algorithm::starts_with, to_upper_copy
@@ -48,11 +51,22 @@ namespace openvpn {
       OPENVPN_EXCEPTION(polarssl_cipher_not_found);
       OPENVPN_SIMPLE_EXCEPTION(polarssl_cipher_undefined);
 
-      Cipher() : cipher_(NULL) {}
+      Cipher() : cipher_(NULL), gcm_(false) {}
 
       Cipher(const std::string& name)
+	: gcm_(false)
       {
-	const std::string translated_name = openvpn_to_cipher_name(name.c_str());
+	std::string translated_name = openvpn_to_cipher_name(name.c_str());
+
+	// The PolarSSL 1.2 cipher layer doesn't know about GCM, so we
+	// drive gcm.h directly and borrow AES key size info from CBC.
+	if (boost::algorithm::starts_with(translated_name, "AES-")
+	    && boost::algorithm::ends_with(translated_name, "-GCM"))
+	  {
+	    translated_name.replace(translated_name.length() - 3, 3, "CBC");
+	    gcm_ = true;
+	  }
+
 	cipher_ = cipher_info_from_string(translated_name.c_str());
 	if (!cipher_)
 	  throw polarssl_cipher_not_found(translated_name);
@@ -61,6 +75,12 @@ namespace openvpn {
       std::string name() const
       {
 	check_initialized();
+	if (gcm_)
+	  {
+	    std::string n(cipher_->name);
+	    n.replace(n.length() - 3, 3, "GCM");
+	    return n;
+	  }
 	return cipher_name_to_openvpn(cipher_->name);
       }
 
@@ -79,17 +99,23 @@ namespace openvpn {
       size_t iv_length() const
       {
 	check_initialized();
-	return cipher_->iv_size;
+	return gcm_ ? GCM_IV_LENGTH : cipher_->iv_size;
       }
 
       size_t block_size() const
       {
 	check_initialized();
-	return cipher_->block_size;
+	return gcm_ ? 1 : cipher_->block_size;
       }
 
       bool defined() const { return cipher_ != NULL; }
 
+      bool is_aead() const { return gcm_; }
+
+      enum {
+	GCM_IV_LENGTH = 12
+      };
+
     private:
       const cipher_info_t *get() const
       {
@@ -123,6 +149,7 @@ namespace openvpn {
       }
 
       const cipher_info_t *cipher_;
+      bool gcm_;
     };
 
     class CipherContext : boost::noncopyable
@@ -142,11 +169,13 @@ namespace openvpn {
       // PolarSSL cipher constants
       enum {
 	MAX_IV_LENGTH = POLARSSL_MAX_IV_LENGTH,
-	CIPH_CBC_MODE = POLARSSL_MODE_CBC
+	CIPH_CBC_MODE = POLARSSL_MODE_CBC,
+	AEAD_TAG_LENGTH = 16,
+	SUPPORTS_AEAD = 1
       };
 
       CipherContext()
-	: initialized(false)
+	: initialized(false), gcm(false)
       {
       }
 
@@ -167,6 +196,16 @@ namespace openvpn {
 	// get cipher type
 	const cipher_info_t *ci = cipher.get();
 
+	// AES-GCM bypasses the cipher layer
+	if (cipher.is_aead())
+	  {
+	    if (gcm_init(&gcm_ctx, key, ci->key_length) < 0)
+	      throw polarssl_cipher_error("gcm_init");
+	    gcm = true;
+	    initialized = true;
+	    return;
+	  }
+
 	// initialize cipher context with cipher type
 	if (cipher_init_ctx(&ctx, ci) < 0)
 	  throw polarssl_cipher_error("cipher_init_ctx");
@@ -218,20 +257,53 @@ namespace openvpn {
       size_t iv_length() const
       {
 	check_initialized();
-	return cipher_get_iv_size(&ctx);
+	return gcm ? size_t(Cipher::GCM_IV_LENGTH) : size_t(cipher_get_iv_size(&ctx));
       }
 
       size_t block_size() const
       {
 	check_initialized();
-	return cipher_get_block_size(&ctx);
+	return gcm ? 1 : cipher_get_block_size(&ctx);
       }
 
       // return cipher mode (such as CIPH_CBC_MODE, etc.)
       int cipher_mode() const
       {
 	check_initialized();
-	return cipher_get_cipher_mode(&ctx);
+	return gcm ? int(POLARSSL_MODE_NONE) : int(cipher_get_cipher_mode(&ctx));
+      }
+
+      // return true if cipher is an AEAD cipher such as AES-GCM
+      bool is_aead() const
+      {
+	check_initialized();
+	return gcm;
+      }
+
+      // Single-pass AEAD encrypt of in -> out (length bytes each),
+      // authenticating ad and writing an AEAD_TAG_LENGTH byte tag.
+      bool aead_encrypt(const unsigned char *iv,
+			unsigned char *out, const unsigned char *in, const size_t length,
+			const unsigned char *ad, const size_t ad_len,
+			unsigned char *tag)
+      {
+	check_initialized();
+	return gcm_crypt_and_tag(&gcm_ctx, GCM_ENCRYPT, length,
+				 iv, Cipher::GCM_IV_LENGTH, ad, ad_len,
+				 in, out, AEAD_TAG_LENGTH, tag) == 0;
+      }
+
+      // Single-pass AEAD decrypt of in -> out (length bytes each).
+      // Returns false if tag does not authenticate ciphertext and ad.
+      bool aead_decrypt(const unsigned char *iv,
+			unsigned char *out, const unsigned char *in, const size_t length,
+			const unsigned char *ad, const size_t ad_len,
+			const unsigned char *tag)
+      {
+	check_initialized();
+	return gcm_auth_decrypt(&gcm_ctx, length,
+				iv, Cipher::GCM_IV_LENGTH, ad, ad_len,
+				tag, AEAD_TAG_LENGTH, in, out) == 0;
       }
 
     private:
@@ -239,7 +311,11 @@ namespace openvpn {
       {
 	if (initialized)
 	  {
-	    cipher_free_ctx(&ctx);
+	    if (gcm)
+	      std::memset(&gcm_ctx, 0, sizeof(gcm_ctx));
+	    else
+	      cipher_free_ctx(&ctx);
+	    gcm = false;
 	    initialized = false;
 	  }
       }
@@ -253,7 +329,9 @@ namespace openvpn {
       }
 
       cipher_context_t ctx;
+      gcm_context gcm_ctx;
       bool initialized;
+      bool gcm;
     };
   }
 }
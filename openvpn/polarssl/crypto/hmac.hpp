@@ -26,6 +26,18 @@
 #define OPENVPN_POLARSSL_CRYPTO_HMAC_H
 
 #include <string>
+#include <cstring>
+
+#include <polarssl/version.h>
+#include <polarssl/md5.h>
+#include <polarssl/sha1.h>
+#if POLARSSL_VERSION_NUMBER >= 0x01030000
+#include <polarssl/sha256.h>
+#include <polarssl/sha512.h>
+#else
+#include <polarssl/sha2.h>
+#include <polarssl/sha4.h>
+#endif
 
 #include <boost/noncopyable.hpp>
 
@@ -35,6 +47,10 @@
 
 namespace openvpn {
   namespace PolarSSLCrypto {
+    // md_hmac_reset and md_hmac_finish hash the ipad and opad key blocks
+    // on every use.  For the common digests, we instead hash them once in
+    // init, save the resulting inner and outer digest states, and copy
+    // them back in for each HMAC.  Other digests use the md_hmac API.
     class HMACContext : boost::noncopyable
     {
     public:
@@ -42,16 +58,23 @@ namespace openvpn {
       OPENVPN_EXCEPTION(polarssl_hmac_error);
 
       enum {
-	MAX_HMAC_SIZE = POLARSSL_MD_MAX_SIZE
+	MAX_HMAC_SIZE = POLARSSL_MD_MAX_SIZE,
+	MAX_BLOCK_SIZE = 128,
       };
 
       HMACContext()
-	: initialized(false)
+	: initialized(false),
+	  state_size(0),
+	  inner_state(NULL),
+	  outer_state(NULL)
       {
       }
 
       HMACContext(const Digest& digest, const unsigned char *key, const size_t key_size)
-	: initialized(false)
+	: initialized(false),
+	  state_size(0),
+	  inner_state(NULL),
+	  outer_state(NULL)
       {
 	init(digest, key, key_size);
       }
@@ -62,31 +85,59 @@ namespace openvpn {
       {
 	erase();
 	ctx.md_ctx = NULL;
+	outer.md_ctx = NULL;
 	if (md_init_ctx(&ctx, digest.get()) < 0)
 	  throw polarssl_hmac_error("md_init_ctx");
-	if (md_hmac_starts(&ctx, key, key_size) < 0)
-	  throw polarssl_hmac_error("md_hmac_starts");
 	initialized = true;
+	state_size = md_state_size(digest.get());
+	if (state_size)
+	  {
+	    if (md_init_ctx(&outer, digest.get()) < 0)
+	      throw polarssl_hmac_error("md_init_ctx");
+	    inner_state = new unsigned char[state_size];
+	    outer_state = new unsigned char[state_size];
+	    precompute(digest.get(), key, key_size);
+	  }
+	else if (md_hmac_starts(&ctx, key, key_size) < 0)
+	  throw polarssl_hmac_error("md_hmac_starts");
       }
 
       void reset()
       {
 	check_initialized();
-	if (md_hmac_reset(&ctx) < 0)
+	if (state_size)
+	  std::memcpy(ctx.md_ctx, inner_state, state_size);
+	else if (md_hmac_reset(&ctx) < 0)
 	  throw polarssl_hmac_error("md_hmac_reset");
       }
 
       void update(const unsigned char *in, const size_t size)
       {
 	check_initialized();
-	if (md_hmac_update(&ctx, in, size) < 0)
+	if (state_size)
+	  {
+	    if (md_update(&ctx, in, size) < 0)
+	      throw polarssl_hmac_error("md_update");
+	  }
+	else if (md_hmac_update(&ctx, in, size) < 0)
 	  throw polarssl_hmac_error("md_hmac_update");
       }
 
       size_t final(unsigned char *out)
       {
 	check_initialized();
-	if (md_hmac_finish(&ctx, out) < 0)
+	if (state_size)
+	  {
+	    unsigned char inner_digest[POLARSSL_MD_MAX_SIZE];
+	    if (md_finish(&ctx, inner_digest) < 0)
+	      throw polarssl_hmac_error("md_finish");
+	    std::memcpy(outer.md_ctx, outer_state, state_size);
+	    if (md_update(&outer, inner_digest, size_()) < 0
+		|| md_finish(&outer, out) < 0)
+	      throw polarssl_hmac_error("md_finish (outer)");
+	    std::memset(inner_digest, 0, sizeof(inner_digest));
+	  }
+	else if (md_hmac_finish(&ctx, out) < 0)
 	  throw polarssl_hmac_error("md_hmac_finish");
 	return size_();
       }
@@ -100,15 +151,108 @@ namespace openvpn {
       bool is_initialized() const { return initialized; }
 
     private:
+      // Leave ctx in the keyed inner state, and save it and the
+      // keyed outer state.
+      void precompute(const md_info_t *info, const unsigned char *key, size_t key_size)
+      {
+	const size_t block_size = md_block_size(info);
+	unsigned char k[MAX_BLOCK_SIZE];
+	unsigned char pad[MAX_BLOCK_SIZE];
+
+	// keys longer than a block are hashed first
+	std::memset(k, 0, sizeof(k));
+	if (key_size > block_size)
+	  {
+	    if (md(info, key, key_size, k) < 0)
+	      throw polarssl_hmac_error("md (key)");
+	  }
+	else
+	  std::memcpy(k, key, key_size);
+
+	for (size_t i = 0; i < block_size; ++i)
+	  pad[i] = k[i] ^ 0x36;
+	if (md_starts(&ctx) < 0 || md_update(&ctx, pad, block_size) < 0)
+	  throw polarssl_hmac_error("md_update (ipad)");
+	std::memcpy(inner_state, ctx.md_ctx, state_size);
+
+	for (size_t i = 0; i < block_size; ++i)
+	  pad[i] = k[i] ^ 0x5C;
+	if (md_starts(&outer) < 0 || md_update(&outer, pad, block_size) < 0)
+	  throw polarssl_hmac_error("md_update (opad)");
+	std::memcpy(outer_state, outer.md_ctx, state_size);
+
+	std::memset(k, 0, sizeof(k));
+	std::memset(pad, 0, sizeof(pad));
+      }
+
+      // size of the digest context that md_ctx points to, or 0
+      // if we don't know it
+      static size_t md_state_size(const md_info_t *info)
+      {
+	switch (info->type)
+	  {
+	  case POLARSSL_MD_MD5:
+	    return sizeof(md5_context);
+	  case POLARSSL_MD_SHA1:
+	    return sizeof(sha1_context);
+#if POLARSSL_VERSION_NUMBER >= 0x01030000
+	  case POLARSSL_MD_SHA224:
+	  case POLARSSL_MD_SHA256:
+	    return sizeof(sha256_context);
+	  case POLARSSL_MD_SHA384:
+	  case POLARSSL_MD_SHA512:
+	    return sizeof(sha512_context);
+#else
+	  case POLARSSL_MD_SHA224:
+	  case POLARSSL_MD_SHA256:
+	    return sizeof(sha2_context);
+	  case POLARSSL_MD_SHA384:
+	  case POLARSSL_MD_SHA512:
+	    return sizeof(sha4_context);
+#endif
+	  default:
+	    return 0;
+	  }
+      }
+
+      static size_t md_block_size(const md_info_t *info)
+      {
+	switch (info->type)
+	  {
+	  case POLARSSL_MD_SHA384:
+	  case POLARSSL_MD_SHA512:
+	    return 128;
+	  default:
+	    return 64;
+	  }
+      }
+
       void erase()
       {
 	if (initialized)
 	  {
 	    md_free_ctx(&ctx);
+	    if (state_size)
+	      {
+		md_free_ctx(&outer);
+		free_state(inner_state);
+		free_state(outer_state);
+		state_size = 0;
+	      }
 	    initialized = false;
 	  }
       }
 
+      void free_state(unsigned char *&state)
+      {
+	if (state)
+	  {
+	    std::memset(state, 0, state_size);
+	    delete [] state;
+	    state = NULL;
+	  }
+      }
+
       size_t size_() const
       {
 	return ctx.md_info->size;
@@ -123,7 +267,11 @@ namespace openvpn {
       }
 
       bool initialized;
+      size_t state_size;          // non-zero if using saved states
+      unsigned char *inner_state; // digest state after hashing key ^ ipad
+      unsigned char *outer_state; // digest state after hashing key ^ opad
       md_context_t ctx;
+      md_context_t outer;
     };
   }
 }
@@ -20,7 +20,8 @@
 //    If not, see <http://www.gnu.org/licenses/>.
 
 // Pseudo-random number generator used for medium strength cryptographic
-// items such as IVs but not keys.
+// items such as IVs but not keys.  Output is generated either by iterated
+// hashing of a secret nonce, or in bulk as a block cipher keystream.
 
 #ifndef OPENVPN_RANDOM_PRNG_H
 #define OPENVPN_RANDOM_PRNG_H
@@ -28,9 +29,13 @@
 #include <cstring>
 #include <algorithm>
 
+#include <boost/cstdint.hpp> // for boost::uint64_t
+
 #include <openvpn/common/exception.hpp>
 #include <openvpn/common/rc.hpp>
 #include <openvpn/buffer/buffer.hpp>
+#include <openvpn/crypto/cipher.hpp>
+#include <openvpn/crypto/static_key.hpp>
 
 namespace openvpn {
 
@@ -44,34 +49,52 @@ namespace openvpn {
     enum {
       NONCE_SECRET_LEN_MIN = 16,
       NONCE_SECRET_LEN_MAX = 64,
-      NONCE_DEFAULT_RESEED_BYTES = 4096
+      NONCE_DEFAULT_RESEED_BYTES = 4096,
+      KEYSTREAM_DEFAULT_RESEED_BYTES = 1024*1024,
+      KEYSTREAM_REFILL_SIZE = 1024,
     };
 
     OPENVPN_SIMPLE_EXCEPTION(prng_bad_digest);
     OPENVPN_SIMPLE_EXCEPTION(prng_bad_nonce_len);
     OPENVPN_SIMPLE_EXCEPTION(prng_internal_error);
+    OPENVPN_SIMPLE_EXCEPTION(prng_bad_cipher);
+    OPENVPN_SIMPLE_EXCEPTION(prng_not_initialized);
 
-    PRNG() : nonce_reseed_bytes(0), n_processed(0) {}
+    PRNG() : nonce_reseed_bytes(0), n_processed(0), ks_pos(0), ks_counter(0) {}
 
     PRNG(const char *digest,
 	 const typename RAND_API::Ptr& rng_arg,
 	 const size_t nonce_secret_len,
 	 const size_t nonce_reseed_bytes_arg = NONCE_DEFAULT_RESEED_BYTES)
-      : nonce_reseed_bytes(0), n_processed(0)
+      : nonce_reseed_bytes(0), n_processed(0), ks_pos(0), ks_counter(0)
     {
       init(digest, rng_arg, nonce_secret_len, nonce_reseed_bytes_arg);
     }
 
+    PRNG(const typename CRYPTO_API::Cipher& cipher,
+	 const typename RAND_API::Ptr& rng_arg,
+	 const size_t reseed_bytes_arg = KEYSTREAM_DEFAULT_RESEED_BYTES)
+      : nonce_reseed_bytes(0), n_processed(0), ks_pos(0), ks_counter(0)
+    {
+      init(cipher, rng_arg, reseed_bytes_arg);
+    }
+
     void init(const char *digest,
 	      const typename RAND_API::Ptr& rng_arg,
 	      const size_t nonce_secret_len,
 	      const size_t nonce_reseed_bytes_arg = NONCE_DEFAULT_RESEED_BYTES)
+    {
+      init(typename CRYPTO_API::Digest(digest), rng_arg, nonce_secret_len, nonce_reseed_bytes_arg);
+    }
+
+    void init(const typename CRYPTO_API::Digest& md,
+	      const typename RAND_API::Ptr& rng_arg,
+	      const size_t nonce_secret_len,
+	      const size_t nonce_reseed_bytes_arg = NONCE_DEFAULT_RESEED_BYTES)
     {
       if (nonce_secret_len < NONCE_SECRET_LEN_MIN || nonce_secret_len > NONCE_SECRET_LEN_MAX)
 	throw prng_bad_nonce_len();
 
-      typename CRYPTO_API::Digest md = typename CRYPTO_API::Digest(digest);
-
       // allocate array for nonce and seed it
       nonce_t nd(md.size() + nonce_secret_len, nonce_t::DESTRUCT_ZERO|nonce_t::ARRAY);
       reseed(nd, *rng_arg);
@@ -85,10 +108,63 @@ namespace openvpn {
       nonce_data.move(nd);
     }
 
+    // Generate output as a block cipher keystream: blocks holding a
+    // running counter are encrypted KEYSTREAM_REFILL_SIZE bytes at a time
+    // into a buffer that rand_bytes serves from.  Key and IV come from
+    // rng and are replaced after every reseed_bytes of output.
+    void init(const typename CRYPTO_API::Cipher& cipher,
+	      const typename RAND_API::Ptr& rng_arg,
+	      const size_t reseed_bytes_arg = KEYSTREAM_DEFAULT_RESEED_BYTES)
+    {
+      if (!cipher.defined() || cipher.block_size() < sizeof(ks_counter))
+	throw prng_bad_cipher();
+
+      rng = rng_arg;
+      nonce_reseed_bytes = reseed_bytes_arg;
+      nonce_digest = typename CRYPTO_API::Digest();
+      nonce_data.clear();
+      ks_cipher = cipher;
+      ks_in.init(KEYSTREAM_REFILL_SIZE, nonce_t::CONSTRUCT_ZERO|nonce_t::DESTRUCT_ZERO|nonce_t::ARRAY);
+      ks_out.init(KEYSTREAM_REFILL_SIZE + cipher.block_size(), nonce_t::DESTRUCT_ZERO|nonce_t::ARRAY);
+      ks_rekey();
+      ks_refill();
+    }
+
+    // Return a new PRNG of the same kind (keystream cipher, or nonce
+    // digest and secret length) as this one, seeded from rng now.  The
+    // new PRNG never reseeds, so that it can be handed to a thread that
+    // must not touch rng.  To reseed it, spawn a replacement.
+    Ptr spawn() const
+    {
+      Ptr ret(new PRNG());
+      if (ks_cipher.defined())
+	ret->init(ks_cipher, rng, 0);
+      else if (nonce_digest.defined())
+	ret->init(nonce_digest, rng, nonce_data.size() - nonce_digest.size(), 0);
+      else
+	throw prng_not_initialized();
+      return ret;
+    }
+
     void
     rand_bytes (unsigned char *output, size_t len)
     {
-      if (nonce_digest.defined())
+      if (ks_cipher.defined())
+	{
+	  while (len > 0)
+	    {
+	      if (ks_pos >= KEYSTREAM_REFILL_SIZE)
+		ks_refill();
+	      const size_t blen = std::min(len, size_t(KEYSTREAM_REFILL_SIZE) - ks_pos);
+	      unsigned char *ks = ks_out.data() + ks_pos;
+	      memcpy (output, ks, blen);
+	      memset (ks, 0, blen); // don't leave handed-out bytes lying around
+	      ks_pos += blen;
+	      output += blen;
+	      len -= blen;
+	    }
+	}
+      else if (nonce_digest.defined())
 	{
 	  const size_t md_size = nonce_digest.size();
 	  while (len > 0)
@@ -119,6 +195,40 @@ namespace openvpn {
     }
 
   private:
+    // draw a new keystream key and IV from rng
+    void ks_rekey()
+    {
+      nonce_t key(ks_cipher.key_length(), nonce_t::DESTRUCT_ZERO|nonce_t::ARRAY);
+      reseed(key, *rng);
+      ks_ctx.init(ks_cipher, StaticKey(key.c_data(), key.size()), CRYPTO_API::CipherContext::ENCRYPT);
+      ks_iv.init(ks_cipher.iv_length(), nonce_t::DESTRUCT_ZERO|nonce_t::ARRAY);
+      reseed(ks_iv, *rng);
+      ks_counter = 0;
+      n_processed = 0;
+    }
+
+    // encrypt the next run of counter blocks into ks_out
+    void ks_refill()
+    {
+      if (nonce_reseed_bytes && n_processed >= nonce_reseed_bytes)
+	ks_rekey();
+
+      const size_t block_size = ks_cipher.block_size();
+      unsigned char *in = ks_in.data();
+      for (size_t i = 0; i < KEYSTREAM_REFILL_SIZE; i += block_size)
+	{
+	  ++ks_counter;
+	  memcpy (in + i, &ks_counter, sizeof(ks_counter));
+	}
+
+      const size_t outlen = ks_ctx.encrypt(ks_iv.c_data(), ks_out.data(), ks_out.size(),
+					   ks_in.c_data(), KEYSTREAM_REFILL_SIZE);
+      if (outlen < KEYSTREAM_REFILL_SIZE)
+	throw prng_internal_error();
+      ks_pos = 0;
+      n_processed += KEYSTREAM_REFILL_SIZE;
+    }
+
     static void reseed (nonce_t& nd, RAND_API& rng)
     {
 #if 1 /* Must be 1 for real usage */
@@ -138,6 +248,15 @@ namespace openvpn {
     size_t nonce_reseed_bytes;
     size_t n_processed;
     nonce_t nonce_data;
+
+    // keystream method
+    typename CRYPTO_API::Cipher ks_cipher;
+    CipherContext<CRYPTO_API> ks_ctx;
+    nonce_t ks_iv;
+    nonce_t ks_in;
+    nonce_t ks_out;
+    size_t ks_pos;
+    boost::uint64_t ks_counter;
   };
 
 } // namespace openvpn
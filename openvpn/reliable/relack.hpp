@@ -28,18 +28,32 @@
 #include <algorithm>
 #include <limits>
 
+#include <boost/cstdint.hpp>
+
 #include <openvpn/common/socktypes.hpp>
 #include <openvpn/buffer/buffer.hpp>
 #include <openvpn/crypto/packet_id.hpp>
+#include <openvpn/time/time.hpp>
 #include <openvpn/reliable/relcommon.hpp>
 
 namespace openvpn {
 
+  // ACKs are normally sent as a length byte followed by that many
+  // message IDs.  Peers that have agreed to it may instead send a
+  // cumulative+selective ACK (SACK), flagged by SACK_FLAG in the length
+  // byte, followed by an ID before which every message was received and
+  // a bitmap of the received messages at and after that ID.  One SACK
+  // acknowledges everything pending, however many packets arrived.
   class ReliableAck
   {
   public:
     typedef reliable::id_t id_t;
 
+    enum {
+      SACK_FLAG = 0x80, // never set in the length byte of an ACK list
+      SACK_SPAN = 64,   // messages covered by the SACK bitmap
+    };
+
     ReliableAck(const size_t max_ack_list)
       : max_ack_list_(max_ack_list ? max_ack_list : std::numeric_limits<size_t>::max()) {}
 
@@ -53,14 +67,33 @@ namespace openvpn {
     // If live is false, read the ACK IDs, but don't modify rel_send.
     // Return the number of ACK IDs read.
     template <typename REL_SEND>
-    static size_t ack(REL_SEND& rel_send, Buffer& buf, const bool live)
+    static size_t ack(REL_SEND& rel_send, Buffer& buf, const bool live, const Time& now)
     {
       const size_t len = buf.pop_front();
+      if (len & SACK_FLAG)
+	{
+	  const id_t head = read_id(buf);
+	  const boost::uint64_t bitmap = read_bitmap(buf);
+	  if (live)
+	    {
+	      // bound by the send window, as head comes from the peer
+	      const id_t begin = rel_send.head_id();
+	      const id_t end = std::min(head, rel_send.tail_id());
+	      for (id_t id = begin; id < end; ++id)
+		rel_send.ack(id, now);
+	      for (unsigned int i = 0; i < SACK_SPAN; ++i)
+		{
+		  if (bitmap & (boost::uint64_t(1) << i))
+		    rel_send.ack(head + i, now);
+		}
+	    }
+	  return 1;
+	}
       for (size_t i = 0; i < len; ++i)
 	{
 	  const id_t id = read_id(buf);
 	  if (live)
-	    rel_send.ack(id);
+	    rel_send.ack(id, now);
 	}
       return len;
     }
@@ -68,20 +101,39 @@ namespace openvpn {
     static size_t ack_skip(Buffer& buf)
     {
       const size_t len = buf.pop_front();
+      if (len & SACK_FLAG)
+	{
+	  read_id(buf);
+	  read_bitmap(buf);
+	  return 1;
+	}
       for (size_t i = 0; i < len; ++i)
 	read_id(buf);
       return len;
     }
 
-    // copy ACKs from buffer to self
-    void read(Buffer& buf)
+    // Copy ACKs from buffer to self, returning the number read.  A SACK
+    // is copied as the IDs in its bitmap, and counts as one.
+    size_t read(Buffer& buf)
     {
       const size_t len = buf.pop_front();
+      if (len & SACK_FLAG)
+	{
+	  const id_t head = read_id(buf);
+	  const boost::uint64_t bitmap = read_bitmap(buf);
+	  for (unsigned int i = 0; i < SACK_SPAN; ++i)
+	    {
+	      if (bitmap & (boost::uint64_t(1) << i))
+		data.push_back(head + i);
+	    }
+	  return 1;
+	}
       for (size_t i = 0; i < len; ++i)
 	{
 	  const id_t id = read_id(buf);
 	  data.push_back(id);
 	}
+      return len;
     }
 
     // called to write outgoing ACKs to buf
@@ -96,6 +148,18 @@ namespace openvpn {
       data.erase (data.begin(), data.begin()+len);
     }
 
+    // Write a SACK to buf in place of the ACK list, given the receive
+    // state of the reliability layer (see ReliableRecvTemplate::head_id
+    // and received_bitmap).  As long as the receive window is no larger
+    // than SACK_SPAN, this covers every pending ACK.
+    void prepend_sack(Buffer& buf, const id_t head, const boost::uint64_t bitmap)
+    {
+      prepend_bitmap(buf, bitmap);
+      prepend_id(buf, head);
+      buf.push_front((unsigned char)SACK_FLAG);
+      data.clear();
+    }
+
     static void prepend_id(Buffer& buf, const id_t id)
     {
       const id_t net_id = htonl(id);
@@ -110,6 +174,18 @@ namespace openvpn {
     }
 
   private:
+    static void prepend_bitmap(Buffer& buf, const boost::uint64_t bitmap)
+    {
+      prepend_id(buf, id_t(bitmap & 0xFFFFFFFF));
+      prepend_id(buf, id_t(bitmap >> 32));
+    }
+
+    static boost::uint64_t read_bitmap(Buffer& buf)
+    {
+      const boost::uint64_t high = read_id(buf);
+      return (high << 32) | read_id(buf);
+    }
+
     size_t max_ack_list_; // Maximum number of ACKs placed in a single message by prepend_acklist()
     std::deque<id_t> data;
   };
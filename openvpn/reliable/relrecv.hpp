@@ -24,6 +24,10 @@
 #ifndef OPENVPN_RELIABLE_RELRECV_H
 #define OPENVPN_RELIABLE_RELRECV_H
 
+#include <algorithm>
+
+#include <boost/cstdint.hpp>
+
 #include <openvpn/common/types.hpp>
 #include <openvpn/common/exception.hpp>
 #include <openvpn/common/msgwin.hpp>
@@ -71,6 +75,26 @@ namespace openvpn {
 	return window_.pre_window(id) ? ACK_TO_SENDER : 0;
     }
 
+    // Return the id of the next message expected in sequence.
+    // Every message before it has been received.
+    id_t head_id() const { return window_.head_id(); }
+
+    // Return a bitmap of the messages received at or after head_id(),
+    // where bit i is set if head_id()+i has been received.  Only the
+    // first 64 ids of the window are represented.
+    boost::uint64_t received_bitmap() const
+    {
+      boost::uint64_t ret = 0;
+      const id_t head = window_.head_id();
+      const id_t n = std::min(window_.span(), id_t(64));
+      for (id_t i = 0; i < n; ++i)
+	{
+	  if (window_.defined_by_id(head + i))
+	    ret |= boost::uint64_t(1) << i;
+	}
+      return ret;
+    }
+
     // Return true if next_sequenced() is ready to return next message
     bool ready() const { return window_.head_defined(); }
 
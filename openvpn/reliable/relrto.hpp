@@ -0,0 +1,134 @@
+//    OpenVPN -- An application to securely tunnel IP networks
+//               over a single port, with support for SSL/TLS-based
+//               session authentication and key exchange,
+//               packet encryption, packet authentication, and
+//               packet compression.
+//
+//    Copyright (C) 2013 OpenVPN Technologies, Inc.
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Affero General Public License Version 3
+//    as published by the Free Software Foundation.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Affero General Public License for more details.
+//
+//    You should have received a copy of the GNU Affero General Public License
+//    along with this program in the COPYING file.
+//    If not, see <http://www.gnu.org/licenses/>.
+
+// Retransmit timeout estimation for reliability layer
+
+#ifndef OPENVPN_RELIABLE_RELRTO_H
+#define OPENVPN_RELIABLE_RELRTO_H
+
+#include <openvpn/time/time.hpp>
+
+namespace openvpn {
+
+  // Jacobson/Karels smoothed RTT and RTT variance, with RTO = SRTT + 4*RTTVAR
+  // (RFC 6298).  Samples must only be taken from ACKs of messages that were
+  // never retransmitted (Karn's rule).  Each retransmit timeout doubles the
+  // RTO until the next valid sample.
+  class ReliableRTO
+  {
+  public:
+    enum {
+      INITIAL_MS = 2000, // RTO before the first sample
+      MIN_MS = 250,
+      MAX_MS = 16000,
+    };
+
+    ReliableRTO()
+      : srtt8_(0),
+	rttvar4_(0),
+	base_(ms(INITIAL_MS)),
+	backoff_(0),
+	defined_(false)
+    {
+    }
+
+    // true once an RTT sample has been taken
+    bool defined() const { return defined_; }
+
+    Time::Duration srtt() const { return Time::Duration::binary_ms(srtt8_ >> 3); }
+    Time::Duration rttvar() const { return Time::Duration::binary_ms(rttvar4_ >> 2); }
+
+    // current RTO, including any backoff
+    Time::Duration rto() const
+    {
+      T r = base_;
+      for (unsigned int i = 0; i < backoff_ && r < ms(MAX_MS); ++i)
+	r <<= 1;
+      if (r > ms(MAX_MS))
+	r = ms(MAX_MS);
+      return Time::Duration::binary_ms(r);
+    }
+
+    void sample(const Time::Duration& rtt)
+    {
+      long m = long(rtt.raw());
+      if (defined_)
+	{
+	  m -= srtt8_ >> 3;
+	  srtt8_ += m;           // SRTT += (R - SRTT) / 8
+	  if (m < 0)
+	    m = -m;
+	  m -= rttvar4_ >> 2;
+	  rttvar4_ += m;         // RTTVAR += (|R - SRTT| - RTTVAR) / 4
+	}
+      else
+	{
+	  srtt8_ = m << 3;       // SRTT = R
+	  rttvar4_ = m << 1;     // RTTVAR = R / 2
+	  defined_ = true;
+	}
+      T r = T((srtt8_ >> 3) + rttvar4_);
+      if (r < ms(MIN_MS))
+	r = ms(MIN_MS);
+      else if (r > ms(MAX_MS))
+	r = ms(MAX_MS);
+      base_ = r;
+      backoff_ = 0;
+    }
+
+    // Take over the RTT estimate of another instance, such as that of
+    // an earlier key context, but not its backoff, which belongs to
+    // messages that the other instance was retransmitting.
+    void assign_estimate(const ReliableRTO& other)
+    {
+      srtt8_ = other.srtt8_;
+      rttvar4_ = other.rttvar4_;
+      base_ = other.base_;
+      defined_ = other.defined_;
+      backoff_ = 0;
+    }
+
+    // Called when a message is retransmitted for the nth time.  Messages
+    // that time out together only back off the RTO once.
+    void backoff(const unsigned int n)
+    {
+      if (n > backoff_ && rto().raw() < ms(MAX_MS))
+	backoff_ = n;
+    }
+
+  private:
+    typedef Time::type T;
+
+    static T ms(const T v)
+    {
+      return v * Time::prec / 1000;
+    }
+
+    long srtt8_;            // SRTT scaled by 8, in binary ms
+    long rttvar4_;          // RTTVAR scaled by 4, in binary ms
+    T base_;                // RTO before backoff
+    unsigned int backoff_;  // RTO is doubled this many times
+    bool defined_;
+  };
+
+} // namespace openvpn
+
+#endif // OPENVPN_RELIABLE_RELRTO_H
@@ -24,11 +24,14 @@
 #ifndef OPENVPN_RELIABLE_RELSEND_H
 #define OPENVPN_RELIABLE_RELSEND_H
 
+#include <deque>
+
 #include <openvpn/common/types.hpp>
 #include <openvpn/common/exception.hpp>
 #include <openvpn/common/msgwin.hpp>
 #include <openvpn/time/time.hpp>
 #include <openvpn/reliable/relcommon.hpp>
+#include <openvpn/reliable/relrto.hpp>
 
 namespace openvpn {
 
@@ -38,16 +41,14 @@ namespace openvpn {
   public:
     typedef reliable::id_t id_t;
 
-    enum {
-      RETRANSMIT = 2 // retransmit in N seconds if ACK not received
-    };
-
     class Message : public ReliableMessageBase<PACKET>
     {
       friend class ReliableSendTemplate;
       using ReliableMessageBase<PACKET>::defined;
 
     public:
+      Message() : retransmits_(0) {}
+
       bool ready_retransmit(const Time& now) const
       {
 	return defined() && now >= retransmit_at_;
@@ -61,13 +62,13 @@ namespace openvpn {
 	return ret;
       }
 
-      void reset_retransmit(const Time& now)
-      {
-	retransmit_at_ = now + Time::Duration::seconds(RETRANSMIT);
-      }
+      // number of times message has been retransmitted
+      unsigned int retransmits() const { return retransmits_; }
 
     private:
+      Time sent_at_;
       Time retransmit_at_;
+      unsigned int retransmits_;
     };
 
     ReliableSendTemplate() : next(0) {}
@@ -77,6 +78,7 @@ namespace openvpn {
     {
       next = 0;
       window_.init(next, span);
+      deadlines_.clear();
     }
 
     // Return the id that the object at the head of the queue
@@ -99,18 +101,22 @@ namespace openvpn {
     // Return the shortest duration for any pending retransmissions
     Time::Duration until_retransmit(const Time& now)
     {
-      Time::Duration ret = Time::Duration::infinite();
-      for (id_t i = head_id(); i < tail_id(); ++i)
-	{
-	  const Message& msg = ref_by_id(i);
-	  if (msg.defined())
-	    {
-	      Time::Duration ut = msg.until_retransmit(now);
-	      if (ut < ret)
-		ret = ut;
-	    }
-	}
-      return ret;
+      purge_deadlines();
+      if (deadlines_.empty())
+	return Time::Duration::infinite();
+      return ref_by_id(deadlines_.front().id).until_retransmit(now);
+    }
+
+    // Return the next message that is due for retransmission, or NULL
+    // if none is.  Call reset_retransmit after retransmitting it.
+    Message* next_due(const Time& now)
+    {
+      purge_deadlines();
+      if (deadlines_.empty() || now < deadlines_.front().at)
+	return NULL;
+      Message& msg = ref_by_id(deadlines_.front().id);
+      deadlines_.pop_front();
+      return &msg;
     }
 
     // Return number of unacknowleged packets in send queue
@@ -132,18 +138,86 @@ namespace openvpn {
     {
       Message& msg = window_.ref_by_id(next);
       msg.id_ = next++;
-      msg.reset_retransmit(now);
+      msg.sent_at_ = now;
+      msg.retransmits_ = 0;
+      schedule(msg, now + rto_.rto());
       return msg;
     }
 
+    // Called after msg has been retransmitted to back off the RTO
+    // and schedule the next retransmission.
+    void reset_retransmit(Message& msg, const Time& now)
+    {
+      rto_.backoff(++msg.retransmits_);
+      schedule(msg, now + rto_.rto());
+    }
+
     // Return true if send queue is ready to receive another packet
     bool ready() const { return window_.in_window(next); }
 
-    // Remove a message from send queue that has been acknowledged
-    void ack(const id_t id) { window_.rm_by_id(id); }
+    // Remove a message from send queue that has been acknowledged,
+    // taking an RTT sample if it was only sent once (Karn's rule).
+    // IDs not yet sent are ignored, so that the peer can't move the
+    // window past them.
+    void ack(const id_t id, const Time& now)
+    {
+      if (id >= next)
+	return;
+      if (window_.in_window(id))
+	{
+	  const Message& msg = window_.ref_by_id(id);
+	  if (msg.defined() && !msg.retransmits_ && now >= msg.sent_at_)
+	    rto_.sample(now - msg.sent_at_);
+	}
+      window_.rm_by_id(id);
+    }
+
+    // RTT/RTO estimate, which may be carried over from another
+    // reliability layer over the same path, leaving its backoff behind
+    const ReliableRTO& rto() const { return rto_; }
+    void set_rto(const ReliableRTO& rto) { rto_.assign_estimate(rto); }
 
   private:
+    struct Deadline
+    {
+      Deadline(const id_t id_arg, const Time& at_arg) : id(id_arg), at(at_arg) {}
+
+      id_t id;
+      Time at;
+    };
+
+    // Deadlines are queued in order, so the front is always the next
+    // one due.  Most deadlines go at the back, but one that is earlier
+    // than those queued (after the RTO shrinks) is inserted in its place,
+    // found by scanning back over the at most one window of later ones.
+    void schedule(Message& msg, const Time& at)
+    {
+      msg.retransmit_at_ = at;
+      typename std::deque<Deadline>::iterator i = deadlines_.end();
+      while (i != deadlines_.begin() && at < (i - 1)->at)
+	--i;
+      deadlines_.insert(i, Deadline(msg.id_, at));
+    }
+
+    // drop deadlines of messages since ACKed or rescheduled
+    void purge_deadlines()
+    {
+      while (!deadlines_.empty())
+	{
+	  const Deadline& d = deadlines_.front();
+	  if (window_.in_window(d.id))
+	    {
+	      const Message& msg = ref_by_id(d.id);
+	      if (msg.defined() && msg.retransmit_at_ == d.at)
+		break;
+	    }
+	  deadlines_.pop_front();
+	}
+    }
+
     id_t next;
+    ReliableRTO rto_;
+    std::deque<Deadline> deadlines_;
     MessageWindow<Message, id_t> window_;
   };
 
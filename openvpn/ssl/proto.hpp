@@ -42,14 +42,18 @@
 #include <openvpn/common/mode.hpp>
 #include <openvpn/common/socktypes.hpp>
 #include <openvpn/common/number.hpp>
+#include <openvpn/common/scoped_ptr.hpp>
 #include <openvpn/buffer/buffer.hpp>
 #include <openvpn/time/time.hpp>
+#include <openvpn/time/timewheel.hpp>
 #include <openvpn/frame/frame.hpp>
+#include <openvpn/frame/frame_init.hpp>
 #include <openvpn/random/prng.hpp>
 #include <openvpn/crypto/crypto.hpp>
 #include <openvpn/crypto/packet_id.hpp>
 #include <openvpn/crypto/static_key.hpp>
 #include <openvpn/log/sessionstats.hpp>
+#include <openvpn/reliable/relrto.hpp>
 #include <openvpn/ssl/protostack.hpp>
 #include <openvpn/ssl/psid.hpp>
 #include <openvpn/ssl/tlsprf.hpp>
@@ -221,11 +225,13 @@ namespace openvpn {
 			{
 				reliable_window = 0;
 				max_ack_list = 0;
+				reliable_sack = true;
 				pid_mode = 0;
 				pid_seq_backtrack = 0;
 				pid_time_backtrack = 0;
 				autologin = false;
 				key_direction = -1; // bidirectional
+				data_pipeline_workers = 0;
 			}
 
 			// master SSL context
@@ -237,6 +243,11 @@ namespace openvpn {
 			// (non-smart) pointer to current time
 			TimePtr now;
 
+			// if defined, protocol deadlines are armed on this wheel, and
+			// the owner is told of each through deadline_expired(), rather
+			// than polling next_housekeeping()
+			TimingWheel::Ptr timer_wheel;
+
 			// RNG
 			typename RAND_API::Ptr rng;
 
@@ -266,8 +277,13 @@ namespace openvpn {
 			int key_direction; // 0, 1, or -1 for bidirectional
 
 			// reliability layer parms
-			reliable::id_t reliable_window;
-			size_t max_ack_list;
+			enum {
+				RELIABLE_WINDOW_MAX = 64, // larger windows only help if the peer receives as many
+				MAX_ACK_LIST_MAX = 8,     // most ACKs that an OpenVPN 2.x peer accepts in one packet
+			};
+			reliable::id_t reliable_window; // control packets in flight, "reliable-window" option
+			size_t max_ack_list;            // ACKs per control packet, "max-ack-list" option
+			bool reliable_sack;             // offer and accept cumulative+selective ACKs (see ReliableAck)
 
 			// packet_id parms for both data and control channels
 			int pid_mode;            // PacketIDReceive::UDP_MODE or PacketIDReceive::TCP_MODE
@@ -284,11 +300,15 @@ namespace openvpn {
 			Time::Duration keepalive_ping;
 			Time::Duration keepalive_timeout;
 
+			// number of worker threads for data channel crypto and
+			// compression, or 0 to do that work inline (see data_pipeline)
+			size_t data_pipeline_workers;
+
 			void load(const OptionList& opt, const ProtoContextOptions& pco, const int default_key_direction)
 			{
-				// first set defaults
-				reliable_window = 4;
-				max_ack_list = 4;
+				// first set defaults (an OpenVPN 2.x peer receives up to 8 packets ahead)
+				reliable_window = 8;
+				max_ack_list = 8;
 				pid_seq_backtrack = 64;
 				pid_time_backtrack = 30;
 				handshake_window = Time::Duration::seconds(60);
@@ -314,6 +334,12 @@ namespace openvpn {
 						renegotiate.to_seconds() / 2));
 				}
 
+				// reliability layer parms
+				{
+					load_count_parm(reliable_window, "reliable-window", reliable::id_t(RELIABLE_WINDOW_MAX), opt);
+					load_count_parm(max_ack_list, "max-ack-list", size_t(MAX_ACK_LIST_MAX), opt);
+				}
+
 				// layer
 				{
 					const Option* dev = opt.get_ptr("dev-type");
@@ -559,7 +585,7 @@ namespace openvpn {
 					out << ",keydir " << key_direction;
 
 				out << ",cipher " << (cipher.defined() ? cipher.name() : "[null-cipher]");
-				out << ",auth " << (digest.defined() ? digest.name() : "[null-digest]");
+				out << ",auth " << (digest.defined() && !is_aead() ? digest.name() : "[null-digest]");
 				out << ",keysize " << (cipher.defined() ? cipher.key_length_in_bits() : 0);
 				if (tls_auth_key.defined())
 					out << ",tls-auth";
@@ -580,7 +606,12 @@ namespace openvpn {
 				std::ostringstream out;
 				out << "IV_VER=" << OPENVPN_VERSION << '\n';
 				out << "IV_PLAT=" << platform_name() << '\n';
-				out << "IV_NCP=1\n"; // negotiable crypto parameters
+				if (CRYPTO_API::CipherContext::SUPPORTS_AEAD)
+					out << "IV_NCP=2\n"; // negotiable crypto parameters, including AES-GCM
+				else
+					out << "IV_NCP=1\n"; // negotiable crypto parameters
+				if (reliable_sack)
+					out << "IV_SACK=1\n"; // accepts cumulative+selective ACKs, server should push "reliable-sack"
 				{
 					const char *compstr = comp_ctx.peer_info_string();
 					if (compstr)
@@ -591,6 +622,93 @@ namespace openvpn {
 				return ret;
 			}
 
+			// AEAD ciphers provide their own authentication, so digest is unused
+			bool is_aead() const
+			{
+				return cipher.defined() && cipher.is_aead();
+			}
+
+			// names of the data channel cipher and digest, empty if none
+			std::string cipher_name() const
+			{
+				return cipher.defined() ? cipher.name() : std::string();
+			}
+
+			std::string digest_name() const
+			{
+				return digest.defined() ? digest.name() : std::string();
+			}
+
+			// Most that the data channel prepends to a tun packet.  The TCP
+			// length prefix is always included, since the transport may
+			// change on reconnect.
+			size_t data_headroom() const
+			{
+				size_t ret = sizeof(boost::uint16_t) +           // TCP-streamed packet length
+					1 +                                            // leading op byte
+					comp_ctx.extra_payload_bytes() +               // compression magic byte
+					PacketID::size(PacketID::SHORT_FORM);          // sequence number
+				if (is_aead())
+					ret += CRYPTO_API::CipherContext::AEAD_TAG_LENGTH; // AEAD tag
+				else
+					ret += (digest.defined() ? digest.size() : 0) +  // HMAC
+						(cipher.defined() ? cipher.iv_length() : 0);   // Cipher IV
+				return ret;
+			}
+
+			// Most that the data channel appends to a tun packet
+			size_t data_tailroom() const
+			{
+				return comp_ctx.extra_payload_bytes() +          // compression swap byte
+					(cipher.defined() && !is_aead() ? cipher.block_size() : 0); // CBC padding
+			}
+
+			// Most that the control channel prepends to SSL ciphertext,
+			// with a full ACK list.  As for the data channel, the TCP length
+			// prefix is always included.
+			size_t control_headroom() const
+			{
+				size_t ret = sizeof(boost::uint16_t) +           // TCP-streamed packet length
+					1 +                                            // leading op byte
+					ProtoSessionID::SIZE +                         // source PSID
+					1 + max_ack_list * sizeof(reliable::id_t) +    // ACK list
+					ProtoSessionID::SIZE +                         // dest PSID, sent with ACKs
+					sizeof(reliable::id_t);                        // message sequence number
+				if (tls_auth_key.defined() && tls_auth_digest.defined())
+					ret += tls_auth_digest.size() +                // tls-auth HMAC
+						PacketID::size(PacketID::LONG_FORM);         // tls-auth packet ID
+				return ret;
+			}
+
+			// Most SSL ciphertext that fits in one control packet, so that
+			// packets stay within mtu() on the wire over IPv4 or IPv6.
+			size_t control_payload() const
+			{
+				const size_t ip_udp_header = 40 + 8; // IPv6 + UDP
+				return mtu() - ip_udp_header - control_headroom();
+			}
+
+			// size frame's data and control channel contexts for the options above
+			void plan_frame() const
+			{
+				frame_plan(*frame, data_headroom(), data_tailroom(), control_payload());
+			}
+
+			template <typename T>
+			static const Option *load_count_parm(T& count, const char *name, const T maxcount, const OptionList& opt)
+			{
+				const Option *o = opt.get_ptr(name);
+				if (o)
+				{
+					unsigned int value = 0;
+					const bool status = parse_number<unsigned int>(o->get(1, 16), value);
+					if (!status || value == 0)
+						OPENVPN_THROW(proto_option_error, name << ": error parsing count");
+					count = std::min(T(value), maxcount);
+				}
+				return o;
+			}
+
 			static const Option *load_duration_parm(Time::Duration& dur, const char *name, const OptionList& opt)
 			{
 				const unsigned int maxdur = 60*60*24*7; // maximum duration -- 7 days
@@ -619,6 +737,13 @@ namespace openvpn {
 			// used to generate link_mtu option sent to peer
 			unsigned int link_mtu_adjust() const
 			{
+				if (is_aead())
+					return protocol.extra_transport_bytes() +        // extra 2 bytes for TCP-streamed packet length
+						1 +                                            // leading op byte
+						comp_ctx.extra_payload_bytes() +               // compression magic byte
+						PacketID::size(PacketID::SHORT_FORM) +         // sequence number
+						CRYPTO_API::CipherContext::AEAD_TAG_LENGTH;    // AEAD tag
+
 				return protocol.extra_transport_bytes() +        // extra 2 bytes for TCP-streamed packet length
 					1 +                                            // leading op byte
 					comp_ctx.extra_payload_bytes() +               // compression magic byte
@@ -714,8 +839,7 @@ namespace openvpn {
 					}
 
 					ReliableAck ack(0);
-					ack.read(b);
-					const bool dest_psid_defined = !ack.empty();
+					const bool dest_psid_defined = ack.read(b) > 0;
 					out << " ACK=[";
 					while (!ack.empty())
 					{
@@ -886,6 +1010,149 @@ namespace openvpn {
 			BufferPtr buf;
 		};
 
+		class KeyContext;
+
+		// A protocol deadline, armed on config->timer_wheel if defined
+		class Deadline : public TimingWheel::Timer
+		{
+		public:
+			Deadline(ProtoContext& proto) : proto_(proto) {}
+
+			// expire at the given time, or never if infinite
+			void set(const Time& at)
+			{
+				TimingWheel* wheel = proto_.config->timer_wheel.get();
+				if (wheel && (!armed() || at != expiry()))
+					wheel->arm(*this, at);
+			}
+
+			// Only bring the deadline forward.  For hot paths that only
+			// ever push a deadline back, where firing at the earlier time
+			// costs a needless housekeeping pass that sets it exactly.
+			void set_earlier(const Time& at)
+			{
+				TimingWheel* wheel = proto_.config->timer_wheel.get();
+				if (wheel && (!armed() || at < expiry()))
+					wheel->arm(*this, at);
+			}
+
+		private:
+			virtual void timer_expired()
+			{
+				proto_.deadline_expired();
+			}
+
+			ProtoContext& proto_;
+		};
+
+	public:
+		// Collects errors raised on a worker thread, such as by a
+		// decompressor, so that they can be reported to the session
+		// stats from the ProtoContext thread.
+		class LaneStats : public SessionStats
+		{
+		public:
+			typedef boost::intrusive_ptr<LaneStats> Ptr;
+
+			LaneStats() : err(Error::SUCCESS) {}
+
+			virtual void error(const size_t type, const std::string* text=NULL)
+			{
+				err = Error::Type(type);
+			}
+
+			Error::Type err;
+		};
+
+		// Data channel state of one KeyContext, replicated once per
+		// worker thread of the data channel pipeline.  A worker only
+		// touches its own lane, so lanes need no locking.  Packet IDs
+		// are still assigned and replay-checked by the owning KeyContext
+		// on the ProtoContext thread, which is also the only thread that
+		// takes or drops references to this object.
+		class DataLanes : public RC<thread_unsafe_refcount>
+		{
+		public:
+			typedef boost::intrusive_ptr<DataLanes> Ptr;
+
+			struct Lane
+			{
+				Lane() : stats(new LaneStats()) {}
+
+				CryptoContext<RAND_API, CRYPTO_API> crypto;
+				Compress::Ptr compress;
+				typename LaneStats::Ptr stats;
+			};
+
+			DataLanes(const size_t n_lanes, const unsigned char op_arg, const bool compress_null_arg)
+				: lanes(new Lane[n_lanes]),
+				op(op_arg),
+				compress_null(compress_null_arg),
+				owner(NULL)
+			{
+			}
+
+			Lane& operator[](const size_t i) { return lanes.get()[i]; }
+
+			ScopedPtr<Lane, PtrArrayFree> lanes;
+			const unsigned char op; // DATA_V1 opcode and key ID
+			const bool compress_null; // lane compressors are CompressNull
+			KeyContext* owner;      // NULL once owning KeyContext is gone
+		};
+
+		// A data channel packet on its way through the pipeline.  The
+		// ProtoContext thread fills it in with data_pipeline_encrypt or
+		// data_pipeline_decrypt, a worker thread calls run, and the
+		// ProtoContext thread completes it with data_pipeline_finish.
+		struct DataJob
+		{
+			DataJob() : encrypt(false), err(Error::SUCCESS) {}
+
+			void run(const size_t worker_index)
+			{
+				typename DataLanes::Lane& lane = (*lanes)[worker_index];
+				try {
+					if (encrypt)
+					{
+						if (!lanes->compress_null)
+							lane.compress->compress(buf, true);
+						lane.crypto.encrypt.encrypt(buf, pid);
+						buf.push_front(lanes->op);
+					}
+					else
+					{
+						// knock off leading op from buffer
+						buf.advance(1);
+
+						// decrypt packet, deferring the replay check
+						err = lane.crypto.decrypt.decrypt(buf, 0, &pid);
+						if (!err && !lanes->compress_null)
+							lane.compress->decompress(buf);
+					}
+					if (!err && lane.stats->err)
+						err = lane.stats->err;
+					lane.stats->err = Error::SUCCESS;
+				}
+				catch (BufferException&)
+				{
+					err = Error::BUFFER_ERROR;
+					buf.reset_size();
+				}
+				catch (const std::exception&)
+				{
+					err = Error::ENCAPSULATION_ERROR;
+					buf.reset_size();
+				}
+			}
+
+			BufferAllocated buf;
+			typename DataLanes::Ptr lanes;
+			PacketID pid;
+			bool encrypt;
+			Error::Type err;
+		};
+
+	protected:
 		// KeyContext encapsulates a single SSL/TLS session
 		class KeyContext : ProtoStackBase<SSLContext, Packet>, public RC<thread_unsafe_refcount>
 		{
@@ -922,6 +1189,8 @@ namespace openvpn {
 				: Base(*p.config->ssl_ctx, p.config->now, p.config->frame, p.stats,
 				p.config->reliable_window, p.config->max_ack_list),
 				proto(p),
+				retransmit_deadline(p),
+				event_deadline(p),
 				state(STATE_UNDEF),
 				dirty(0),
 				handled_pid_wrap(false),
@@ -941,13 +1210,28 @@ namespace openvpn {
 				// set must-negotiate-by time
 				set_event(KEV_NONE, KEV_NEGOTIATE, construct_time + p.config->handshake_window);
 
+				// start retransmitting at the RTO measured by earlier key contexts
+				rel_send.set_rto(p.control_rto_);
+
 				construct_compressor();
 			}
 
+			virtual ~KeyContext()
+			{
+				if (lanes)
+					lanes->owner = NULL;
+			}
+
 			// construct compressor/decompressor
 			void construct_compressor()
 			{
 				compress = proto.config->comp_ctx.new_compressor(proto.config->frame, proto.stats);
+				compress_null = proto.config->comp_ctx.is_null();
+
+				// pipeline lanes hold their own compressors, and may
+				// already exist if compression was pushed after ACTIVE
+				if (lanes)
+					init_data_lanes();
 			}
 
 			// need to call only on the initiator side of the connection
@@ -970,6 +1254,7 @@ namespace openvpn {
 					Base::flush();
 					send_pending_acks();
 					dirty = false;
+					retransmit_deadline.set(Base::next_retransmit());
 				}
 			}
 
@@ -983,6 +1268,13 @@ namespace openvpn {
 			{
 				// note that we don't set dirty here
 				Base::retransmit();
+				retransmit_deadline.set(Base::next_retransmit());
+			}
+
+			void cancel_deadlines()
+			{
+				retransmit_deadline.cancel();
+				event_deadline.cancel();
 			}
 
 			// when should we next call retransmit method
@@ -1020,10 +1312,11 @@ namespace openvpn {
 				if (state >= ACTIVE && !invalidated())
 				{
 					// compress packet
-					compress->compress(buf, true);
+					if (!compress_null)
+						compress->compress(buf, true);
 
 					// encrypt packet
-					crypto.encrypt.encrypt(buf, now->seconds_since_epoch());
+					crypto->encrypt.encrypt(buf, now->seconds_since_epoch());
 
 					// prepend op
 					buf.push_front(op_compose(DATA_V1, key_id_));
@@ -1035,6 +1328,90 @@ namespace openvpn {
 					buf.reset_size(); // no crypto context available
 			}
 
+			// data channel encrypt of a burst of packets, with the
+			// key state check, clock read and pid wrap test done once,
+			// and CBC IVs drawn together (see Encrypt::encrypt_burst).
+			// Compression is per packet.  There is no decrypt
+			// counterpart, as received packets reach the data channel
+			// one at a time.
+			void encrypt_burst(BufferAllocated *const *bufs, const size_t n)
+			{
+				if (state >= ACTIVE && !invalidated())
+				{
+					const PacketID::time_t t = now->seconds_since_epoch();
+
+					// compress packets
+					if (!compress_null)
+						for (size_t i = 0; i < n; ++i)
+							compress->compress(*bufs[i], true);
+
+					// encrypt packets
+					crypto->encrypt.encrypt_burst(bufs, n, t);
+
+					// prepend op
+					const unsigned char op = op_compose(DATA_V1, key_id_);
+					for (size_t i = 0; i < n; ++i)
+						bufs[i]->push_front(op);
+
+					// check for rare situation where packet ID is near overflow
+					test_pid_wrap();
+				}
+				else
+				{
+					for (size_t i = 0; i < n; ++i)
+						bufs[i]->reset_size(); // no crypto context available
+				}
+			}
+
+			// prepare a data channel packet for encryption by
+			// a worker thread, assigning its packet ID here
+			bool pipeline_encrypt(DataJob& job)
+			{
+				if (state >= ACTIVE && !invalidated() && lanes)
+				{
+					job.lanes = lanes;
+					job.pid = crypto->encrypt.pid_send.next(now->seconds_since_epoch());
+					job.encrypt = true;
+					job.err = Error::SUCCESS;
+
+					// check for rare situation where packet ID is near overflow
+					test_pid_wrap();
+					return true;
+				}
+				job.buf.reset_size(); // no crypto context available
+				return false;
+			}
+
+			// prepare a data channel packet for decryption by a worker thread
+			bool pipeline_decrypt(DataJob& job)
+			{
+				if (state >= ACTIVE && !invalidated() && lanes)
+				{
+					job.lanes = lanes;
+					job.encrypt = false;
+					job.err = Error::SUCCESS;
+					return true;
+				}
+				job.buf.reset_size(); // no crypto context available
+				return false;
+			}
+
+			// replay check of a packet decrypted by a worker thread,
+			// called in the order the packets were received
+			void pipeline_decrypt_finish(DataJob& job)
+			{
+				if (state >= ACTIVE && !invalidated())
+				{
+					if (!job.err && !crypto->decrypt.accept_packet_id(job.pid, now->seconds_since_epoch()))
+					{
+						job.err = Error::REPLAY_ERROR;
+						job.buf.reset_size();
+					}
+				}
+				else
+					job.buf.reset_size();
+			}
+
 			// data channel decrypt
 			void decrypt(BufferAllocated& buf)
 			{
@@ -1045,7 +1422,7 @@ namespace openvpn {
 						buf.advance(1);
 
 						// decrypt packet
-						const Error::Type err = crypto.decrypt.decrypt(buf, now->seconds_since_epoch());
+						const Error::Type err = crypto->decrypt.decrypt(buf, now->seconds_since_epoch());
 						if (err)
 						{
 							proto.stats->error(err);
@@ -1054,7 +1431,8 @@ namespace openvpn {
 						}
 
 						// decompress packet
-						compress->decompress(buf);
+						if (!compress_null)
+							compress->decompress(buf);
 					}
 					else
 						buf.reset_size(); // no crypto context available
@@ -1135,7 +1513,7 @@ namespace openvpn {
 
 					// process packet for transmission
 					compress->compress(*pkt.buf, false); // set compress hint to "no"
-					crypto.encrypt.encrypt(*pkt.buf, now->seconds_since_epoch());
+					crypto->encrypt.encrypt(*pkt.buf, now->seconds_since_epoch());
 					pkt.buf->push_front(op_compose(DATA_V1, key_id_));
 
 					// send it
@@ -1303,6 +1681,7 @@ namespace openvpn {
 				OPENVPN_LOG_PROTO_VERBOSE("KeyContext " << event_type_string(next) << '(' << seconds_until(next_time) << ')');
 				next_event = next;
 				next_event_time = next_time;
+				event_deadline.set(next_time);
 			}
 
 			void set_event(const EventType current, const EventType next, const Time& next_time)
@@ -1311,6 +1690,7 @@ namespace openvpn {
 				current_event = current;
 				next_event = next;
 				next_event_time = next_time;
+				event_deadline.set(next_time);
 			}
 
 			// called by ProtoStackBase when session is invalidated
@@ -1318,6 +1698,9 @@ namespace openvpn {
 			{
 				reached_active_time_ = Time();
 				set_event(KEV_NONE, Time::infinite());
+
+				// owner should notice the invalidation right away
+				event_deadline.set(*now);
 			}
 
 			// Trigger a new SSL/TLS negotiation if packet ID (a 32-bit unsigned int)
@@ -1326,7 +1709,7 @@ namespace openvpn {
 			// think that all further packets are replays.
 			void test_pid_wrap()
 			{
-				if (!handled_pid_wrap && crypto.encrypt.pid_send.wrap_warning())
+				if (!handled_pid_wrap && crypto->encrypt.pid_send.wrap_warning())
 				{
 					trigger_renegotiation();
 					handled_pid_wrap = true;
@@ -1503,6 +1886,8 @@ namespace openvpn {
 					skip_string(buf); // password
 					auth.set_size(buf.offset() - auth.offset());
 					const std::string peer_info = read_auth_string<std::string>(buf);
+					if (proto.config->reliable_sack && peer_info.find("IV_SACK=1\n") != std::string::npos)
+						proto.reliable_sack_ = true;
 					proto.server_auth(auth, peer_info);
 				}
 			}
@@ -1537,36 +1922,111 @@ namespace openvpn {
 			// given our ephemeral session key, initialize the components of the
 			// OpenVPN data channel protocol
 			void init_data_channel_crypto_context(const OpenVPNStaticKey& key)
+			{
+				const Config& c = *proto.config;
+
+				// kept in case the server pushes another cipher or digest
+				data_channel_key = key;
+
+				crypto.reset(new CryptoContext<RAND_API, CRYPTO_API>());
+				init_data_channel_crypto(*crypto, key);
+				crypto->encrypt.prng = c.prng;
+				crypto->decrypt.pid_recv.init(c.pid_mode,
+					PacketID::SHORT_FORM,
+					c.pid_seq_backtrack, c.pid_time_backtrack,
+					"DATA", int(key_id_),
+					proto.stats);
+
+				init_data_lanes();
+			}
+
+			// Pipeline workers get their own copy of the keys, compressor
+			// and PRNG, but packet IDs keep coming from crypto above.
+			// Worker PRNGs are spawned from c.prng, so they generate IVs
+			// the same way, and are seeded from rng here on this thread.
+			// They never reseed themselves, as rng is only safe to use
+			// from this thread; instead the lanes are rebuilt, and so
+			// reseeded, whenever keys rotate or a push changes them.
+			void init_data_lanes()
+			{
+				const Config& c = *proto.config;
+
+				if (proto.data_pipeline())
+				{
+					// jobs already queued finish on the lanes they hold
+					if (lanes)
+						lanes->owner = NULL;
+					lanes.reset(new DataLanes(c.data_pipeline_workers, op_compose(DATA_V1, key_id_), c.comp_ctx.is_null()));
+					lanes->owner = this;
+					for (size_t i = 0; i < c.data_pipeline_workers; ++i)
+					{
+						typename DataLanes::Lane& lane = (*lanes)[i];
+						init_data_channel_crypto(lane.crypto, data_channel_key);
+						lane.crypto.encrypt.prng = c.prng->spawn();
+						lane.compress = proto.config->comp_ctx.new_compressor(c.frame, lane.stats);
+					}
+				}
+			}
+
+		public:
+			// Rekey the data channel from the same key material after the
+			// server pushed a cipher or digest other than the configured
+			// one, as a server that sees IV_NCP=2 does with AES-GCM.  The
+			// packet ID state carries over, so that no packet ID, and so
+			// no AEAD nonce, is used twice.
+			void rekey_data_channel()
+			{
+				if (state >= ACTIVE && data_channel_key.defined())
+				{
+					ScopedPtr<CryptoContext<RAND_API, CRYPTO_API> > cc(new CryptoContext<RAND_API, CRYPTO_API>());
+					init_data_channel_crypto(*cc, data_channel_key);
+					cc->encrypt.prng = proto.config->prng;
+					cc->encrypt.pid_send = crypto->encrypt.pid_send;
+					cc->decrypt.pid_recv = crypto->decrypt.pid_recv;
+					crypto.swap(cc);
+					init_data_lanes();
+				}
+			}
+
+		private:
+
+			// key the cipher and HMAC (or AEAD implicit IV) of both
+			// directions of a data channel CryptoContext
+			void init_data_channel_crypto(CryptoContext<RAND_API, CRYPTO_API>& cc, const OpenVPNStaticKey& key)
 			{
 				const Config& c = *proto.config;
 				const unsigned int key_dir = proto.is_server() ? OpenVPNStaticKey::INVERSE : OpenVPNStaticKey::NORMAL;
 
 				// initialize CryptoContext encrypt
-				crypto.encrypt.frame = c.frame;
+				cc.encrypt.frame = c.frame;
 				if (c.cipher.defined())
-					crypto.encrypt.cipher.init(c.cipher,
+					cc.encrypt.cipher.init(c.cipher,
 					key.slice(OpenVPNStaticKey::CIPHER | OpenVPNStaticKey::ENCRYPT | key_dir),
 					CRYPTO_API::CipherContext::ENCRYPT);
-				if (c.digest.defined())
-					crypto.encrypt.hmac.init(c.digest,
+				if (c.is_aead())
+					cc.encrypt.nonce.set_implicit_iv(
 					key.slice(OpenVPNStaticKey::HMAC | OpenVPNStaticKey::ENCRYPT | key_dir));
-				crypto.encrypt.pid_send.init(PacketID::SHORT_FORM);
-				crypto.encrypt.prng = c.prng;
+				else if (c.digest.defined())
+					cc.encrypt.hmac.init(c.digest,
+					key.slice(OpenVPNStaticKey::HMAC | OpenVPNStaticKey::ENCRYPT | key_dir));
+				cc.encrypt.pid_send.init(PacketID::SHORT_FORM);
 
 				// initialize CryptoContext decrypt
-				crypto.decrypt.frame = c.frame;
+				cc.decrypt.frame = c.frame;
 				if (c.cipher.defined())
-					crypto.decrypt.cipher.init(c.cipher,
+					cc.decrypt.cipher.init(c.cipher,
 					key.slice(OpenVPNStaticKey::CIPHER | OpenVPNStaticKey::DECRYPT | key_dir),
 					CRYPTO_API::CipherContext::DECRYPT);
-				if (c.digest.defined())
-					crypto.decrypt.hmac.init(c.digest,
+				if (c.is_aead())
+					cc.decrypt.nonce.set_implicit_iv(
 					key.slice(OpenVPNStaticKey::HMAC | OpenVPNStaticKey::DECRYPT | key_dir));
-				crypto.decrypt.pid_recv.init(c.pid_mode,
-					PacketID::SHORT_FORM,
-					c.pid_seq_backtrack, c.pid_time_backtrack,
-					"DATA", int(key_id_),
-					proto.stats);
+				else if (c.digest.defined())
+					cc.decrypt.hmac.init(c.digest,
+					key.slice(OpenVPNStaticKey::HMAC | OpenVPNStaticKey::DECRYPT | key_dir));
+
+				// pick the code specialized for this cipher and digest, if any
+				cc.encrypt.select_policy();
+				cc.decrypt.select_policy();
 			}
 
 			// generate message head
@@ -1616,8 +2076,12 @@ namespace openvpn {
 					}
 				}
 
-				// prepend ACKs for messages received from peer
-				xmit_acks.prepend(buf);
+				// prepend ACKs for messages received from peer, as a
+				// single SACK if the peer has said that it accepts one
+				if (proto.reliable_sack_ && !xmit_acks.empty())
+					xmit_acks.prepend_sack(buf, rel_recv.head_id(), rel_recv.received_bitmap());
+				else
+					xmit_acks.prepend(buf);
 			}
 
 			bool verify_src_psid(const ProtoSessionID& src_psid)
@@ -1715,12 +2179,13 @@ namespace openvpn {
 
 						// process ACKs sent by peer (if packet ID check failed,
 						// read the ACK IDs, but don't modify the rel_send object).
-						if (ReliableAck::ack(rel_send, recv, pid_ok))
+						if (ReliableAck::ack(rel_send, recv, pid_ok, *now))
 						{
 							// make sure that our own PSID is contained in packet received from peer
 							if (!verify_dest_psid(recv))
 								return false;
 						}
+						proto.control_rto_ = rel_send.rto();
 
 						// for CONTROL packets only, not ACK
 						if (pkt.opcode != ACK_V1)
@@ -1773,12 +2238,13 @@ namespace openvpn {
 							return false;
 
 						// process ACKs sent by peer
-						if (ReliableAck::ack(rel_send, recv, true))
+						if (ReliableAck::ack(rel_send, recv, true, *now))
 						{
 							// make sure that our own PSID is in packet received from peer
 							if (!verify_dest_psid(recv))
 								return false;
 						}
+						proto.control_rto_ = rel_send.rto();
 
 						// for CONTROL packets only, not ACK
 						if (pkt.opcode != ACK_V1)
@@ -1822,6 +2288,8 @@ namespace openvpn {
 			// BEGIN KeyContext data members
 
 			ProtoContext& proto; // parent
+			Deadline retransmit_deadline;
+			Deadline event_deadline;
 			int state;
 			unsigned int key_id_;
 			bool dirty;
@@ -1833,8 +2301,11 @@ namespace openvpn {
 			EventType current_event;
 			EventType next_event;
 			Compress::Ptr compress;
+			bool compress_null; // compress is CompressNull, so data channel skips it
 			std::deque<BufferPtr> app_pre_write_queue;
-			CryptoContext<RAND_API, CRYPTO_API> crypto;
+			ScopedPtr<CryptoContext<RAND_API, CRYPTO_API> > crypto; // defined once ACTIVE
+			OpenVPNStaticKey data_channel_key; // session key that crypto was keyed with
+			typename DataLanes::Ptr lanes; // defined if data channel pipeline is enabled
 			TLSPRF<CRYPTO_API> tlsprf_self;
 			TLSPRF<CRYPTO_API> tlsprf_peer;
 		};
@@ -1848,7 +2319,10 @@ namespace openvpn {
 			stats(stats_arg),
 			mode_(config_arg->ssl_ctx->mode()),
 			n_key_ids(0),
-			now_(config_arg->now)
+			now_(config_arg->now),
+			reliable_sack_(false),
+			keepalive_xmit_deadline(*this),
+			keepalive_expire_deadline(*this)
 		{
 			const Config& c = *config;
 
@@ -1877,6 +2351,10 @@ namespace openvpn {
 			// by default, fast_transition is turned off
 			fast_transition = false;
 
+			// start over with a new peer, which may not accept SACKs
+			reliable_sack_ = false;
+			control_rto_ = ReliableRTO();
+
 			// clear key contexts
 			primary.reset();
 			secondary.reset();
@@ -1921,6 +2399,7 @@ namespace openvpn {
 			// initialize keepalive timers
 			keepalive_expire = Time::infinite();   // initially disabled
 			update_last_sent();                    // set timer for initial keepalive send
+			set_keepalive_deadlines();
 		}
 
 		virtual ~ProtoContext() {}
@@ -1954,6 +2433,7 @@ namespace openvpn {
 		{
 			primary->start();
 			update_last_received(); // set an upper bound on when we expect a response
+			set_keepalive_deadlines();
 		}
 
 		// trigger a protocol renegotiation
@@ -2001,6 +2481,17 @@ namespace openvpn {
 			keepalive_housekeeping();
 		}
 
+		// Disarm all deadlines on config->timer_wheel, such as when the
+		// session is stopped.
+		void cancel_deadlines()
+		{
+			keepalive_xmit_deadline.cancel();
+			keepalive_expire_deadline.cancel();
+			primary->cancel_deadlines();
+			if (secondary)
+				secondary->cancel_deadlines();
+		}
+
 		// When should we next call housekeeping?
 		// Will return a time value for immediate execution
 		// if session has been invalidated.
@@ -2065,6 +2556,12 @@ namespace openvpn {
 			primary->encrypt(in_out);
 		}
 
+		// encrypt a burst of data channel packets using primary KeyContext
+		void data_encrypt_burst(BufferAllocated *const *bufs, const size_t n)
+		{
+			primary->encrypt_burst(bufs, n);
+		}
+
 		// decrypt a data channel packet (automatically select primary
 		// or secondary KeyContext based on packet content)
 		void data_decrypt(const PacketType& type, BufferAllocated& in_out)
@@ -2082,6 +2579,54 @@ namespace openvpn {
 			}
 		}
 
+		// The data channel pipeline moves crypto and compression of data
+		// channel packets to Config::data_pipeline_workers worker threads
+		// (see OrderedWorkPool).  Instead of calling data_encrypt or
+		// data_decrypt, the caller swaps the packet into a DataJob, calls
+		// data_pipeline_encrypt or data_pipeline_decrypt, passes the job
+		// to a worker if that returned true, and hands the job back to
+		// data_pipeline_finish in the original order once the worker is
+		// done.  Everything except DataJob::run happens on this thread,
+		// so key state and packet IDs are handled as in the inline path.
+		// Only used for UDP, as a full pipeline must drop packets, and the
+		// TCP mode replay check rejects any gap in the packet ID sequence.
+		bool data_pipeline() const
+		{
+			return config->data_pipeline_workers > 0 && config->protocol.is_udp();
+		}
+
+		bool data_pipeline_encrypt(DataJob& job)
+		{
+			return primary->pipeline_encrypt(job);
+		}
+
+		bool data_pipeline_decrypt(const PacketType& type, DataJob& job)
+		{
+			return select_key_context(type, false).pipeline_decrypt(job);
+		}
+
+		void data_pipeline_finish(DataJob& job)
+		{
+			if (!job.encrypt)
+			{
+				if (job.lanes->owner)
+					job.lanes->owner->pipeline_decrypt_finish(job);
+				else
+					job.buf.reset_size(); // KeyContext has gone away
+
+				// update time of most recent packet received
+				if (job.buf.size())
+					update_last_received();
+
+				// discard keepalive packets
+				if (proto_context_private::is_keepalive(job.buf))
+					job.buf.reset_size();
+			}
+			if (job.err)
+				stats->error(job.err);
+			job.lanes.reset();
+		}
+
 		// enter disconnected state
 		void disconnect(const Error::Type reason)
 		{
@@ -2102,6 +2647,7 @@ namespace openvpn {
 		void update_last_sent()
 		{
 			keepalive_xmit = *now_ + config->keepalive_ping;
+			keepalive_xmit_deadline.set_earlier(keepalive_xmit);
 		}
 
 		// can we call data_encrypt or data_decrypt yet?
@@ -2113,6 +2659,10 @@ namespace openvpn {
 		// worst-case handshake time
 		const Time::Duration& slowest_handshake() { return slowest_handshake_; }
 
+		// control channel RTT and retransmit timeout, as estimated by the
+		// reliability layer from ACK timing
+		const ReliableRTO& control_rto() const { return control_rto_; }
+
 		// was primary context invalidated by an exception?
 		bool invalidated() const { return primary->invalidated(); }
 
@@ -2137,11 +2687,33 @@ namespace openvpn {
 		// Call on client with server-pushed options
 		void process_push(const OptionList& opt, const ProtoContextOptions& pco)
 		{
+			const std::string cipher_before = config->cipher_name();
+			const std::string digest_before = config->digest_name();
 			config->process_push(opt, pco);
+
+			// server accepts cumulative+selective ACKs
+			if (config->reliable_sack && opt.exists("reliable-sack"))
+				reliable_sack_ = true;
+
+			// Resize the frame for pushed options before tun is created.
+			// Pipeline workers may already be using the frame, in which
+			// case any packet that doesn't fit is copied instead.
+			if (!config->data_pipeline_workers)
+				config->plan_frame();
+
 			primary->construct_compressor();
 			if (secondary)
 				secondary->construct_compressor();
 
+			// Key contexts that are already ACTIVE were keyed with the
+			// configured cipher and digest before the push arrived.
+			if (config->cipher_name() != cipher_before || config->digest_name() != digest_before)
+			{
+				primary->rekey_data_channel();
+				if (secondary)
+					secondary->rekey_data_channel();
+			}
+
 			// in case keepalive parms were modified by push
 			keepalive_parms_modified();
 		}
@@ -2159,6 +2731,9 @@ namespace openvpn {
 		bool is_server() const { return mode_.is_server(); }
 		bool is_client() const { return mode_.is_client(); }
 
+		// true if control packets to the peer carry SACKs rather than ACK lists
+		bool reliable_sack() const { return reliable_sack_; }
+
 		// tcp/udp mode
 		const bool is_tcp() { return config->protocol.is_tcp(); }
 		const bool is_udp() { return config->protocol.is_udp(); }
@@ -2195,9 +2770,19 @@ namespace openvpn {
 		{
 		}
 
+		// Called from config->timer_wheel when a deadline expires.
+		// Derived classes that must also act on the outcome, such as
+		// an invalidated session, should override.
+		virtual void deadline_expired()
+		{
+			update_now();
+			housekeeping();
+		}
+
 		void update_last_received()
 		{
 			keepalive_expire = *now_ + config->keepalive_timeout;
+			keepalive_expire_deadline.set_earlier(keepalive_expire);
 		}
 
 		void net_send(const unsigned int key_id, const Packet& net_pkt)
@@ -2284,6 +2869,13 @@ namespace openvpn {
 				stats->error(Error::KEEPALIVE_TIMEOUT);
 				disconnect(Error::KEEPALIVE_TIMEOUT);
 			}
+			set_keepalive_deadlines();
+		}
+
+		void set_keepalive_deadlines()
+		{
+			keepalive_xmit_deadline.set(keepalive_xmit);
+			keepalive_expire_deadline.set(keepalive_expire);
 		}
 
 		// Process KEV_x events
@@ -2428,6 +3020,7 @@ namespace openvpn {
 			const Time kx = *now_ + config->keepalive_ping;
 			if (kx < keepalive_xmit)
 				keepalive_xmit = kx;
+			set_keepalive_deadlines();
 		}
 
 		// BEGIN ProtoContext data members
@@ -2446,6 +3039,8 @@ namespace openvpn {
 		Time keepalive_expire;             // time in future when we must have received a packet from peer or we will timeout session
 
 		Time::Duration slowest_handshake_; // longest time to reach a successful handshake
+		ReliableRTO control_rto_;          // most recent RTT/RTO estimate of any KeyContext
+		bool reliable_sack_;               // peer accepts cumulative+selective ACKs (see ReliableAck)
 
 		HMACContext<CRYPTO_API> ta_hmac_send;
 		HMACContext<CRYPTO_API> ta_hmac_recv;
@@ -2458,6 +3053,9 @@ namespace openvpn {
 		typename KeyContext::Ptr primary;
 		typename KeyContext::Ptr secondary;
 
+		Deadline keepalive_xmit_deadline;  // armed on config->timer_wheel, if defined
+		Deadline keepalive_expire_deadline;
+
 		bool fast_transition;
 
 		// END ProtoContext data members
@@ -179,14 +179,11 @@ namespace openvpn {
     {
       if (!invalidated() && *now >= next_retransmit_)
 	{
-	  for (id_t i = rel_send.head_id(); i < rel_send.tail_id(); ++i)
+	  typename ReliableSend::Message* m;
+	  while ((m = rel_send.next_due(*now)))
 	    {
-	      typename ReliableSend::Message& m = rel_send.ref_by_id(i);
-	      if (m.ready_retransmit(*now))
-		{
-		  net_send(m.packet, NET_SEND_RETRANSMIT);
-		  m.reset_retransmit(*now);
-		}
+	      net_send(m->packet, NET_SEND_RETRANSMIT);
+	      rel_send.reset_retransmit(*m, *now);
 	    }
 	  update_retransmit();
 	}
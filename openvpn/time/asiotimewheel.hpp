@@ -0,0 +1,91 @@
+//    OpenVPN -- An application to securely tunnel IP networks
+//               over a single port, with support for SSL/TLS-based
+//               session authentication and key exchange,
+//               packet encryption, packet authentication, and
+//               packet compression.
+//
+//    Copyright (C) 2013 OpenVPN Technologies, Inc.
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Affero General Public License Version 3
+//    as published by the Free Software Foundation.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Affero General Public License for more details.
+//
+//    You should have received a copy of the GNU Affero General Public License
+//    along with this program in the COPYING file.
+//    If not, see <http://www.gnu.org/licenses/>.
+
+// Drive a TimingWheel from one asio timer, which wakes only when the
+// wheel has a slot with timers in it to visit.
+
+#ifndef OPENVPN_TIME_ASIOTIMEWHEEL_H
+#define OPENVPN_TIME_ASIOTIMEWHEEL_H
+
+#include <boost/asio.hpp>
+
+#include <openvpn/common/asiodispatch.hpp>
+#include <openvpn/time/asiotimer.hpp>
+#include <openvpn/time/timewheel.hpp>
+
+namespace openvpn {
+
+  class AsioTimingWheel : public TimingWheel
+  {
+  public:
+    typedef boost::intrusive_ptr<AsioTimingWheel> Ptr;
+
+    AsioTimingWheel(boost::asio::io_service& io_service)
+      : timer_(io_service),
+	scheduled_(Time::infinite()),
+	advancing_(false),
+	halt_(false)
+    {
+    }
+
+    // stop waking up, timers still armed will not fire
+    void stop()
+    {
+      halt_ = true;
+      timer_.cancel();
+    }
+
+  private:
+    virtual void timer_armed(const Time& visit)
+    {
+      // while advancing, the wakeup is rescheduled afterwards
+      if (!advancing_ && !halt_ && visit < scheduled_)
+	schedule(visit);
+    }
+
+    void schedule(const Time& at)
+    {
+      scheduled_ = at;
+      timer_.expires_at(at);
+      timer_.async_wait(asio_dispatch_timer(&AsioTimingWheel::timer_callback, this));
+    }
+
+    void timer_callback(const boost::system::error_code& e)
+    {
+      if (halt_ || e)
+	return;
+      scheduled_ = Time::infinite();
+      advancing_ = true;
+      advance(Time::now());
+      advancing_ = false;
+      if (!halt_ && !empty())
+	schedule(next_visit());
+    }
+
+    AsioTimer timer_;
+    Time scheduled_;
+    bool advancing_;
+    bool halt_;
+  };
+
+} // namespace openvpn
+
+#endif // OPENVPN_TIME_ASIOTIMEWHEEL_H
@@ -0,0 +1,263 @@
+//    OpenVPN -- An application to securely tunnel IP networks
+//               over a single port, with support for SSL/TLS-based
+//               session authentication and key exchange,
+//               packet encryption, packet authentication, and
+//               packet compression.
+//
+//    Copyright (C) 2013 OpenVPN Technologies, Inc.
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Affero General Public License Version 3
+//    as published by the Free Software Foundation.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Affero General Public License for more details.
+//
+//    You should have received a copy of the GNU Affero General Public License
+//    along with this program in the COPYING file.
+//    If not, see <http://www.gnu.org/licenses/>.
+
+// Hashed timing wheel (Varghese and Lauck, scheme 6) for protocol
+// deadlines.  Each Timer is an intrusive list node, so arming and
+// cancelling are O(1) without allocation, and one wheel, driven by one
+// system timer, can hold the deadlines of any number of sessions.
+//
+// Time is divided into ticks of 2^TICK_SHIFT binary ms, and a timer is
+// kept in the slot of the tick it expires on, counting the number of
+// full revolutions of the wheel still to go.  advance() visits only the
+// slots that have timers, found from a bitmap, and next_visit() tells
+// the driver when it next needs to call advance().  Timers never fire
+// early, but may fire up to one tick late.
+
+#ifndef OPENVPN_TIME_TIMEWHEEL_H
+#define OPENVPN_TIME_TIMEWHEEL_H
+
+#include <openvpn/common/types.hpp>
+#include <openvpn/common/rc.hpp>
+#include <openvpn/common/ffs.hpp>
+#include <openvpn/time/time.hpp>
+
+namespace openvpn {
+
+  class TimingWheel : public RC<thread_unsafe_refcount>
+  {
+  public:
+    typedef boost::intrusive_ptr<TimingWheel> Ptr;
+    typedef Time::type tick_t;
+
+    enum {
+      TICK_SHIFT = 6,               // tick is 64 binary ms, about 1/16 second
+      SLOT_SHIFT = 8,
+      N_SLOTS = 1 << SLOT_SHIFT,    // revolution is 256 ticks, about 16 seconds
+      FIRING = N_SLOTS,             // pseudo-slot of timers about to fire
+    };
+
+    class Timer
+    {
+      friend class TimingWheel;
+
+    public:
+      Timer() : wheel_(NULL), prev_(NULL), next_(NULL), slot_(0), rounds_(0) {}
+
+      virtual ~Timer() { cancel(); }
+
+      bool armed() const { return wheel_ != NULL; }
+
+      // the time that the timer was last armed for
+      const Time& expiry() const { return expiry_; }
+
+      void cancel()
+      {
+	if (wheel_)
+	  wheel_->unlink(*this);
+      }
+
+    private:
+      // Called from TimingWheel::advance after expiry.  The timer is no
+      // longer armed, and may be armed again, or destroyed, from here.
+      virtual void timer_expired() = 0;
+
+      Timer(const Timer&);            // not copyable
+      Timer& operator=(const Timer&);
+
+      TimingWheel* wheel_;
+      Timer* prev_;
+      Timer* next_;
+      Time expiry_;
+      size_t slot_;
+      tick_t rounds_;
+    };
+
+    TimingWheel()
+      : current_(tick_of(Time::now())),
+	n_armed_(0)
+    {
+      for (size_t i = 0; i <= N_SLOTS; ++i)
+	slots_[i] = NULL;
+      for (size_t i = 0; i < N_WORDS; ++i)
+	occupied_[i] = 0;
+    }
+
+    virtual ~TimingWheel()
+    {
+      for (size_t i = 0; i <= N_SLOTS; ++i)
+	while (slots_[i])
+	  unlink(*slots_[i]);
+    }
+
+    // Arm t to expire at the given time, replacing any earlier expiry.
+    // An infinite time just cancels t.
+    void arm(Timer& t, const Time& at)
+    {
+      t.cancel();
+      if (at.is_infinite())
+	return;
+
+      // round up, so that timers never fire early
+      tick_t tick = (at.raw() + (tick_t(1) << TICK_SHIFT) - 1) >> TICK_SHIFT;
+      if (tick <= current_)
+	tick = current_ + 1;
+      const tick_t delta = tick - current_;
+
+      t.expiry_ = at;
+      t.rounds_ = (delta - 1) >> SLOT_SHIFT;
+      link(t, size_t(tick & (N_SLOTS - 1)));
+      ++n_armed_;
+      timer_armed(time_of(current_ + 1 + ((delta - 1) & (N_SLOTS - 1))));
+    }
+
+    // Expire every timer that is due by now.
+    void advance(const Time& now)
+    {
+      const tick_t target = tick_of(now);
+      while (n_armed_ && current_ < target)
+	{
+	  const tick_t next = current_ + ticks_to_next_slot();
+	  if (next > target)
+	    break;
+	  current_ = next;
+	  expire_slot(size_t(current_ & (N_SLOTS - 1)));
+	}
+      if (target > current_)
+	current_ = target;
+    }
+
+    // When advance() should next be called, or infinite if no timers
+    // are armed.  This is the next tick with timers in its slot, which
+    // may only be counting down a revolution.
+    Time next_visit() const
+    {
+      if (!n_armed_)
+	return Time::infinite();
+      return time_of(current_ + ticks_to_next_slot());
+    }
+
+    bool empty() const { return !n_armed_; }
+    size_t size() const { return n_armed_; }
+
+  protected:
+    // Called when a timer is armed that may need advance() to be called
+    // before the time last returned by next_visit().  Drivers override
+    // this to bring their wakeup forward.
+    virtual void timer_armed(const Time& visit) {}
+
+  private:
+    enum {
+      N_WORDS = N_SLOTS / 32,
+    };
+
+    static tick_t tick_of(const Time& t)
+    {
+      return t.raw() >> TICK_SHIFT;
+    }
+
+    static Time time_of(const tick_t tick)
+    {
+      return Time::zero() + Time::Duration::binary_ms(tick << TICK_SHIFT);
+    }
+
+    // distance to the next slot after the current one with timers in it,
+    // 1 to N_SLOTS (the current slot, a revolution from now)
+    tick_t ticks_to_next_slot() const
+    {
+      const size_t start = size_t((current_ + 1) & (N_SLOTS - 1));
+      for (size_t n = 0; n <= N_WORDS; ++n)
+	{
+	  const size_t w = ((start >> 5) + n) % N_WORDS;
+	  unsigned int bits = occupied_[w];
+	  if (!n)
+	    bits &= ~0u << (start & 31);
+	  if (bits)
+	    {
+	      const size_t slot = (w << 5) + find_first_set(bits);
+	      return ((slot - start) & (N_SLOTS - 1)) + 1;
+	    }
+	}
+      return N_SLOTS; // not reached while n_armed_ is nonzero
+    }
+
+    void link(Timer& t, const size_t slot)
+    {
+      t.wheel_ = this;
+      t.slot_ = slot;
+      t.prev_ = NULL;
+      t.next_ = slots_[slot];
+      if (t.next_)
+	t.next_->prev_ = &t;
+      slots_[slot] = &t;
+      if (slot < N_SLOTS)
+	occupied_[slot >> 5] |= 1u << (slot & 31);
+    }
+
+    void unlink(Timer& t)
+    {
+      if (t.prev_)
+	t.prev_->next_ = t.next_;
+      else
+	slots_[t.slot_] = t.next_;
+      if (t.next_)
+	t.next_->prev_ = t.prev_;
+      if (t.slot_ < N_SLOTS && !slots_[t.slot_])
+	occupied_[t.slot_ >> 5] &= ~(1u << (t.slot_ & 31));
+      t.wheel_ = NULL;
+      t.prev_ = t.next_ = NULL;
+      --n_armed_;
+    }
+
+    // Move the timers of slot that have no revolutions to go to the
+    // FIRING list, then fire them one at a time.  Callbacks may arm or
+    // cancel any timer, including ones still waiting to fire.
+    void expire_slot(const size_t slot)
+    {
+      Timer* t = slots_[slot];
+      while (t)
+	{
+	  Timer* next = t->next_;
+	  if (t->rounds_)
+	    --t->rounds_;
+	  else
+	    {
+	      unlink(*t);
+	      link(*t, FIRING);
+	      ++n_armed_;
+	    }
+	  t = next;
+	}
+      while ((t = slots_[FIRING]))
+	{
+	  unlink(*t);
+	  t->timer_expired();
+	}
+    }
+
+    tick_t current_;  // last tick that advance() has reached
+    size_t n_armed_;
+    Timer* slots_[N_SLOTS + 1];
+    unsigned int occupied_[N_WORDS];
+  };
+
+} // namespace openvpn
+
+#endif // OPENVPN_TIME_TIMEWHEEL_H
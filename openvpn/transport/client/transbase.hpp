@@ -54,6 +54,10 @@ namespace openvpn {
   // notifications.
   struct TransportClientParent
   {
+    // buf may be a window onto a larger receive buffer holding further
+    // packets.  It may be modified in place or swapped for another
+    // buffer, but must not be written past its end or freed before
+    // transport_recv returns.
     virtual void transport_recv(BufferAllocated& buf) = 0;
     virtual void transport_error(const Error::Type fatal_err, const std::string& err_text) = 0;
     virtual void proxy_error(const Error::Type fatal_err, const std::string& err_text) = 0;
@@ -44,6 +44,8 @@ namespace openvpn {
       RemoteList::Ptr remote_list;
       bool server_addr_float;
       int n_parallel;
+      size_t batch_size; // recvmmsg/sendmmsg batch size on Linux, or 0 to disable
+      unsigned int offload; // UDP GSO/GRO flags (OFFLOAD_x), requires batch_size
       Frame::Ptr frame;
       SessionStats::Ptr stats;
 
@@ -61,6 +63,8 @@ namespace openvpn {
       ClientConfig()
 	: server_addr_float(false),
 	  n_parallel(8),
+	  batch_size(0),
+	  offload(0),
 	  socket_protect(NULL)
       {}
     };
@@ -104,7 +108,10 @@ namespace openvpn {
 
       virtual bool transport_send(BufferAllocated& buf)
       {
-	return send(buf);
+	if (impl)
+	  return impl->send(buf, NULL);
+	else
+	  return false;
       }
 
       virtual void server_endpoint_info(std::string& host, std::string& port, std::string& proto, std::string& ip_addr) const
@@ -219,9 +226,13 @@ namespace openvpn {
 	    if (!error)
 	      {
 		impl.reset(new LinkImpl(this,
+					io_service,
 					socket,
 					(*config->frame)[Frame::READ_LINK_UDP],
-					config->stats));
+					config->stats,
+					config->batch_size,
+					config->offload,
+					(*config->frame)[Frame::READ_LINK_UDP_GRO]));
 		impl->start(config->n_parallel);
 		parent.transport_connecting();
 	      }
@@ -23,6 +23,7 @@
 #define OPENVPN_TRANSPORT_PKTSTREAM_H
 
 #include <algorithm>         // for std::min
+#include <cstring>           // for std::memcpy
 #include <boost/cstdint.hpp> // for boost::uint16_t, etc.
 
 #include <openvpn/common/exception.hpp>
@@ -120,6 +121,34 @@ namespace openvpn {
 	throw packet_not_fully_formed();
     }
 
+    // returns true if no partially received packet is pending
+    bool idle() const
+    {
+      return !declared_size_defined && !buffer.defined();
+    }
+
+    // If buf begins with a fully formed packet, return true and set
+    // size to the length of the packet, not counting the leading
+    // uint16_t size.  buf is not modified.  Used by callers that
+    // consume packets in place, falling back to put/get for packets
+    // that are split across stream fragments.
+    static bool peek(const Buffer& buf, size_t& size, const Frame::Context& frame_context)
+    {
+      if (!size_defined(buf))
+	return false;
+      boost::uint16_t net_len;
+      std::memcpy(&net_len, buf.c_data(), sizeof(net_len));
+      size = ntohs(net_len);
+      validate_size(size, frame_context);
+      return buf.size() - sizeof(net_len) >= size;
+    }
+
+    // size of the uint16_t size prepended to each packet
+    static size_t size_prefix()
+    {
+      return sizeof(boost::uint16_t);
+    }
+
     // prepend uint16_t size to buffer
     static void prepend_size(Buffer& buf)
     {
@@ -25,6 +25,7 @@
 #define OPENVPN_TRANSPORT_TCPLINK_H
 
 #include <deque>
+#include <vector>
 
 #include <boost/asio.hpp>
 
@@ -80,7 +81,8 @@ namespace openvpn {
 	  frame_context(frame_context_arg),
 	  stats(stats_arg),
 	  send_queue_max_size(send_queue_max_size_arg),
-	  free_list_max_size(free_list_max_size_arg)
+	  free_list_max_size(free_list_max_size_arg),
+	  send_bytes(0)
       {
 	set_raw_mode(false);
       }
@@ -161,14 +163,35 @@ namespace openvpn {
 	halt = true;
       }
 
+      // allocator for pending sends and receives
+      const AsioHandlerArena& handler_arena() const { return arena; }
+
       ~Link() { stop(); }
 
     private:
+      enum {
+	SEND_MAX_BUFFERS = 64,     // max queued buffers gathered into one send
+	SEND_MAX_BYTES = 65536,    // byte budget for one send
+      };
+
+      // Gather as much of the send queue as fits in the budget into a
+      // single scatter/gather send.  The front buffer is always included
+      // so that an oversized packet still goes out.
       void queue_send()
       {
-	BufferAllocated& buf = *queue.front();
-	socket.async_send(buf.const_buffers_1(),
-			  asio_dispatch_write(&Link::handle_send, this));
+	send_bufs.clear();
+	size_t bytes = 0;
+	for (Queue::const_iterator i = queue.begin(); i != queue.end() && send_bufs.size() < SEND_MAX_BUFFERS; ++i)
+	  {
+	    const BufferAllocated& buf = **i;
+	    if (!send_bufs.empty() && bytes + buf.size() > SEND_MAX_BYTES)
+	      break;
+	    send_bufs.push_back(boost::asio::const_buffer(buf.c_data(), buf.size()));
+	    bytes += buf.size();
+	  }
+	send_bytes = bytes;
+	socket.async_send(send_bufs,
+			  asio_dispatch_write(&Link::handle_send, this, &arena));
       }
 
       void handle_send(const boost::system::error_code& error, const size_t bytes_sent)
@@ -179,27 +202,38 @@ namespace openvpn {
 	      {
 		OPENVPN_LOG_TCPLINK_VERBOSE("TCP send raw=" << raw_mode << " size=" << bytes_sent);
 		stats->inc_stat(SessionStats::BYTES_OUT, bytes_sent);
-		stats->inc_stat(SessionStats::PACKETS_OUT, 1);
 
-		BufferPtr buf = queue.front();
-		if (bytes_sent == buf->size())
-		  {
-		    queue.pop_front();
-		    if (free_list.size() < free_list_max_size)
-		      {
-			buf->reset_content();
-			free_list.push_back(buf); // recycle the buffer for later use
-		      }
-		  }
-		else if (bytes_sent < buf->size())
-		  buf->advance(bytes_sent);
-		else
+		if (bytes_sent > send_bytes)
 		  {
 		    stats->error(Error::TCP_OVERFLOW);
 		    read_handler->tcp_error_handler("TCP_INTERNAL_ERROR"); // error sent more bytes than we asked for
 		    stop();
 		    return;
 		  }
+
+		// retire fully sent buffers, then advance past the
+		// partially sent one (if any)
+		size_t remaining = bytes_sent;
+		while (remaining)
+		  {
+		    BufferPtr buf = queue.front();
+		    if (remaining >= buf->size())
+		      {
+			remaining -= buf->size();
+			queue.pop_front();
+			stats->inc_stat(SessionStats::PACKETS_OUT, 1);
+			if (free_list.size() < free_list_max_size)
+			  {
+			    buf->reset_content();
+			    free_list.push_back(buf); // recycle the buffer for later use
+			  }
+		      }
+		    else
+		      {
+			buf->advance(remaining);
+			remaining = 0;
+		      }
+		  }
 	      }
 	    else
 	      {
@@ -221,7 +255,7 @@ namespace openvpn {
 	  tcpfrom = new PacketFrom();
 	frame_context.prepare(tcpfrom->buf);
 	socket.async_receive(frame_context.mutable_buffers_1(tcpfrom->buf),
-			     asio_dispatch_read(&Link::handle_recv, this, tcpfrom));
+			     asio_dispatch_read(&Link::handle_recv, this, tcpfrom, &arena));
       }
 
       void handle_recv(PacketFrom *tcpfrom, const boost::system::error_code& error, const size_t bytes_recvd)
@@ -260,17 +294,50 @@ namespace openvpn {
 	  }
       }
 
+      // Extract packets from a stream fragment.  Fully formed packets
+      // are passed to tcp_read_handler in place, by narrowing buf to
+      // each packet in turn, so that only packets straddling two reads
+      // are copied (by pktstream).  tcp_read_handler may modify the
+      // packet or swap it for another buffer, but must not write past
+      // the end of the packet or free its memory before returning.
+      // If the handler does swap it away, the remainder of the fragment
+      // is copied into the buffer it left behind.
       void put_pktstream(BufferAllocated& buf, BufferAllocated& pkt)
       {
 	stats->inc_stat(SessionStats::BYTES_IN, buf.size());
 	stats->inc_stat(SessionStats::PACKETS_IN, 1);
-	while (buf.size())
+	while (buf.size() && !halt)
 	  {
-	    pktstream.put(buf, frame_context);
-	    if (pktstream.ready())
+	    size_t size;
+	    if (pktstream.idle() && PacketStream::peek(buf, size, frame_context))
 	      {
-		pktstream.get(pkt);
-		read_handler->tcp_read_handler(pkt);
+		buf.advance(PacketStream::size_prefix());
+		const unsigned char *base = buf.c_data() - buf.offset();
+		const size_t end = buf.offset() + size;
+		const size_t residual = buf.size() - size;
+		buf.set_size(size);
+		read_handler->tcp_read_handler(buf);
+		if (!residual)
+		  buf.reset_size();
+		else if (buf.c_data() - buf.offset() == base) // still our memory?
+		  {
+		    buf.init_headroom(end);
+		    buf.set_size(residual);
+		  }
+		else
+		  {
+		    frame_context.prepare(buf);
+		    buf.write(base + end, residual);
+		  }
+	      }
+	    else
+	      {
+		pktstream.put(buf, frame_context);
+		if (pktstream.ready())
+		  {
+		    pktstream.get(pkt);
+		    read_handler->tcp_read_handler(pkt);
+		  }
 	      }
 	  }
       }
@@ -285,7 +352,10 @@ namespace openvpn {
       const size_t free_list_max_size;
       Queue queue;      // send queue
       Queue free_list;  // recycled free buffers for send queue
+      std::vector<boost::asio::const_buffer> send_bufs; // gathered by queue_send
+      size_t send_bytes; // total size of send_bufs
       PacketStream pktstream;
+      AsioHandlerArena arena;
     };
   }
 } // namespace openvpn
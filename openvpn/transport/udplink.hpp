@@ -26,6 +26,7 @@
 
 #include <boost/asio.hpp>
 
+#include <openvpn/common/platform.hpp>
 #include <openvpn/common/types.hpp>
 #include <openvpn/common/scoped_ptr.hpp>
 #include <openvpn/common/asiodispatch.hpp>
@@ -33,6 +34,29 @@
 #include <openvpn/frame/frame.hpp>
 #include <openvpn/log/sessionstats.hpp>
 
+// Batched I/O with recvmmsg/sendmmsg is only available on Linux
+#if defined(OPENVPN_PLATFORM_LINUX) && !defined(OPENVPN_UDPLINK_NO_MMSG)
+#define OPENVPN_UDPLINK_MMSG
+#include <cstring>
+#include <errno.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/udp.h>
+#include <vector>
+#include <algorithm>
+#include <boost/cstdint.hpp>
+#ifndef SOL_UDP
+#define SOL_UDP 17
+#endif
+#ifndef UDP_SEGMENT
+#define UDP_SEGMENT 103 // Linux 4.18+
+#endif
+#ifndef UDP_GRO
+#define UDP_GRO 104     // Linux 5.0+
+#endif
+#endif
+
 #if defined(OPENVPN_DEBUG_UDPLINK) && OPENVPN_DEBUG_UDPLINK >= 1
 #define OPENVPN_LOG_UDPLINK_ERROR(x) OPENVPN_LOG(x)
 #else
@@ -57,6 +81,29 @@ namespace openvpn {
       Endpoint sender_endpoint;
     };
 
+    // Segmentation offload flags for Link, only used in batched mode
+    enum {
+      OFFLOAD_GSO = (1<<0), // send runs of equal-size packets as one UDP_SEGMENT buffer
+      OFFLOAD_GRO = (1<<1), // receive UDP_GRO coalesced datagrams and split them
+    };
+
+    // If batch_size is nonzero and OPENVPN_UDPLINK_MMSG is defined, Link
+    // runs in batched mode.  Each completed read is followed by a
+    // recvmmsg call that drains up to batch_size-1 more datagrams into a
+    // fixed pool of PacketFrom objects, all passed on to udp_read_handler.
+    // Sends are queued and then flushed with sendmmsg, either when
+    // batch_size packets are queued or from a handler posted by the first
+    // send after a flush, so one syscall covers all the packets generated
+    // by a single pass through the io_service.
+    //
+    // Batched mode can also use the kernel's UDP segmentation offload.
+    // With OFFLOAD_GSO, each run of equal-size queued packets (the last
+    // one may be shorter) goes out as a single UDP_SEGMENT message.
+    // With OFFLOAD_GRO, datagrams are read into buffers sized by
+    // gro_frame_context for the aggregate, and each coalesced datagram
+    // is split at the UDP_GRO segment size before being handed to
+    // udp_read_handler.  Either offload is silently left off if the
+    // kernel doesn't support it, and GSO is turned off if a send fails.
     template <typename ReadHandler>
     class Link : public RC<thread_unsafe_refcount>
     {
@@ -64,19 +111,129 @@ namespace openvpn {
       typedef boost::intrusive_ptr<Link> Ptr;
 
       Link(ReadHandler read_handler_arg,
+	   boost::asio::io_service& io_service_arg,
 	   boost::asio::ip::udp::socket& socket_arg,
 	   const Frame::Context& frame_context_arg,
-	   const SessionStats::Ptr& stats_arg)
-	: socket(socket_arg),
+	   const SessionStats::Ptr& stats_arg,
+	   const size_t batch_size_arg = 0,
+	   const unsigned int offload = 0,  // OFFLOAD_x flags
+	   const Frame::Context& gro_frame_context_arg = Frame::Context())
+	: io_service(io_service_arg),
+	  socket(socket_arg),
 	  halt(false),
 	  read_handler(read_handler_arg),
 	  frame_context(frame_context_arg),
-	  stats(stats_arg)
+	  gro_frame_context(gro_frame_context_arg),
+	  stats(stats_arg),
+	  batch_size(0),
+	  gso(false),
+	  gro(false)
       {
+#ifdef OPENVPN_UDPLINK_MMSG
+	if (batch_size_arg)
+	  {
+	    batch_size = batch_size_arg;
+	    recv_pool.resize(batch_size);
+	    for (size_t i = 0; i < batch_size; ++i)
+	      recv_pool[i] = new PacketFrom();
+	    recv_msgs.resize(batch_size);
+	    recv_iov.resize(batch_size);
+	    recv_addr.resize(batch_size);
+	    send_queue.resize(batch_size);
+	    send_endpoint.resize(batch_size);
+	    send_msgs.resize(batch_size);
+	    send_iov.resize(batch_size);
+	    send_run.resize(batch_size);
+	    send_control.resize(batch_size);
+	    send_queued = 0;
+	    flush_pending = false;
+	    if (offload & OFFLOAD_GSO)
+	      gso = probe_gso();
+	    if (offload & OFFLOAD_GRO)
+	      gro = enable_gro();
+	  }
+#endif
       }
 
       bool send(const Buffer& buf, Endpoint* endpoint)
       {
+#ifdef OPENVPN_UDPLINK_MMSG
+	if (batch_size)
+	  {
+	    if (halt)
+	      return false;
+	    BufferAllocated& b = queue_send(endpoint);
+	    b.reset(buf.size(), 0);
+	    b.reset_content();
+	    b.write(buf.c_data(), buf.size());
+	    return true;
+	  }
+#endif
+	return send_(buf, endpoint);
+      }
+
+      // like send above, but in batched mode buf is swapped into the
+      // send queue rather than copied
+      bool send(BufferAllocated& buf, Endpoint* endpoint)
+      {
+#ifdef OPENVPN_UDPLINK_MMSG
+	if (batch_size)
+	  {
+	    if (halt)
+	      return false;
+	    queue_send(endpoint).swap(buf);
+	    return true;
+	  }
+#endif
+	return send_(buf, endpoint);
+      }
+
+      void start(const int n_parallel)
+      {
+	if (!halt)
+	  {
+#ifdef OPENVPN_UDPLINK_MMSG
+	    if (gro)
+	      {
+		drain_gro();
+		return;
+	      }
+	    if (batch_size)
+	      {
+		queue_read_batch();
+		return;
+	      }
+#endif
+	    for (int i = 0; i < n_parallel; i++)
+	      queue_read(NULL);
+	  }
+      }
+
+      void stop() {
+#ifdef OPENVPN_UDPLINK_MMSG
+	// send what is still queued, such as an explicit exit notify,
+	// rather than leave it to a handle_flush that will see halt
+	if (!halt && batch_size && send_queued && socket.is_open())
+	  flush_send();
+#endif
+	halt = true;
+      }
+
+      // allocator for pending reads
+      const AsioHandlerArena& handler_arena() const { return arena; }
+
+      ~Link()
+      {
+	stop();
+#ifdef OPENVPN_UDPLINK_MMSG
+	for (size_t i = 0; i < recv_pool.size(); ++i)
+	  delete recv_pool[i];
+#endif
+      }
+
+    private:
+      bool send_(const Buffer& buf, Endpoint* endpoint)
+      {
 	if (!halt)
 	  {
 	    try {
@@ -105,22 +262,6 @@ namespace openvpn {
 	  return false;
       }
 
-      void start(const int n_parallel)
-      {
-	if (!halt)
-	  {
-	    for (int i = 0; i < n_parallel; i++)
-	      queue_read(NULL);
-	  }
-      }
-
-      void stop() {
-	halt = true;
-      }
-
-      ~Link() { stop(); }
-
-    private:
       void queue_read(PacketFrom *udpfrom)
       {
 	OPENVPN_LOG_UDPLINK_VERBOSE("UDPLink::queue_read");
@@ -129,7 +270,7 @@ namespace openvpn {
 	frame_context.prepare(udpfrom->buf);
 	socket.async_receive_from(frame_context.mutable_buffers_1(udpfrom->buf),
 				  udpfrom->sender_endpoint,
-				  asio_dispatch_read(&Link::handle_read, this, udpfrom));
+				  asio_dispatch_read(&Link::handle_read, this, udpfrom, &arena));
       }
 
       void handle_read(PacketFrom *udpfrom, const boost::system::error_code& error, const size_t bytes_recvd)
@@ -158,11 +299,438 @@ namespace openvpn {
 	  }
       }
 
+#ifdef OPENVPN_UDPLINK_MMSG
+      // Wait for the next datagram with an ordinary asio read into
+      // recv_pool[0].  Unlike waiting for readiness with null_buffers,
+      // this never misses datagrams that arrived while the previous
+      // batch was being handled.
+      void queue_read_batch()
+      {
+	OPENVPN_LOG_UDPLINK_VERBOSE("UDPLink::queue_read_batch");
+	PacketFrom* udpfrom = recv_pool[0];
+	frame_context.prepare(udpfrom->buf);
+	socket.async_receive_from(frame_context.mutable_buffers_1(udpfrom->buf),
+				  udpfrom->sender_endpoint,
+				  asio_dispatch_read(&Link::handle_read_batch, this, udpfrom, &arena));
+      }
+
+      void handle_read_batch(PacketFrom*, // always recv_pool[0]
+			     const boost::system::error_code& error, const size_t bytes_recvd)
+      {
+	OPENVPN_LOG_UDPLINK_VERBOSE("UDPLink::handle_read_batch: " << error.message());
+	if (!halt)
+	  {
+	    if (bytes_recvd)
+	      {
+		if (!error)
+		  {
+		    deliver(0, bytes_recvd);
+		    recv_burst();
+		  }
+		else
+		  {
+		    OPENVPN_LOG_UDPLINK_ERROR("UDP recv error: " << error.message());
+		    stats->error(Error::NETWORK_RECV_ERROR);
+		  }
+	      }
+	    if (!halt)
+	      queue_read_batch();
+	  }
+      }
+
+      // drain datagrams already queued on the socket into recv_pool[1..]
+      void recv_burst()
+      {
+	const size_t n = batch_size - 1;
+	if (!n || halt)
+	  return;
+	for (size_t i = 0; i < n; ++i)
+	  {
+	    PacketFrom* udpfrom = recv_pool[i+1];
+	    frame_context.prepare(udpfrom->buf);
+	    recv_iov[i].iov_base = udpfrom->buf.data();
+	    recv_iov[i].iov_len = udpfrom->buf.max_size();
+	    struct msghdr& mh = recv_msgs[i].msg_hdr;
+	    std::memset(&mh, 0, sizeof(mh));
+	    mh.msg_name = &recv_addr[i];
+	    mh.msg_namelen = sizeof(recv_addr[i]);
+	    mh.msg_iov = &recv_iov[i];
+	    mh.msg_iovlen = 1;
+	    recv_msgs[i].msg_len = 0;
+	  }
+	const int status = ::recvmmsg(socket.native_handle(), &recv_msgs[0], n, MSG_DONTWAIT, NULL);
+	if (status < 0)
+	  {
+	    if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+	      {
+		OPENVPN_LOG_UDPLINK_ERROR("UDP recvmmsg error: " << errno);
+		stats->error(Error::NETWORK_RECV_ERROR);
+	      }
+	    return;
+	  }
+	for (int i = 0; i < status && !halt; ++i)
+	  {
+	    const struct msghdr& mh = recv_msgs[i].msg_hdr;
+	    if (mh.msg_namelen > recv_pool[i+1]->sender_endpoint.capacity())
+	      continue;
+	    std::memcpy(recv_pool[i+1]->sender_endpoint.data(), mh.msg_name, mh.msg_namelen);
+	    recv_pool[i+1]->sender_endpoint.resize(mh.msg_namelen);
+	    if (recv_msgs[i].msg_len)
+	      deliver(i+1, recv_msgs[i].msg_len);
+	  }
+      }
+
+      // pass recv_pool[index] to read_handler
+      void deliver(const size_t index, const size_t bytes_recvd)
+      {
+	PacketFrom::SPtr pfp(recv_pool[index]);
+	OPENVPN_LOG_UDPLINK_VERBOSE("UDP from " << pfp->sender_endpoint);
+	pfp->buf.set_size(bytes_recvd);
+	stats->inc_stat(SessionStats::BYTES_IN, bytes_recvd);
+	stats->inc_stat(SessionStats::PACKETS_IN, 1);
+	read_handler->udp_read_handler(pfp);
+	recv_pool[index] = pfp.defined() ? pfp.release() : new PacketFrom(); // replace if read_handler took it
+      }
+
+      // return the next send queue slot, flushing first if the queue is full
+      BufferAllocated& queue_send(Endpoint* endpoint)
+      {
+	if (send_queued == batch_size)
+	  flush_send();
+	if (!flush_pending)
+	  {
+	    flush_pending = true;
+	    io_service.post(asio_dispatch_post(&Link::handle_flush, this));
+	  }
+	const size_t i = send_queued++;
+	if (endpoint)
+	  send_endpoint[i] = *endpoint;
+	else
+	  send_endpoint[i] = Endpoint();
+	return send_queue[i];
+      }
+
+      void handle_flush()
+      {
+	flush_pending = false;
+	if (!halt)
+	  flush_send();
+	else
+	  send_queued = 0;
+      }
+
+      void flush_send()
+      {
+	for (size_t i = 0; i < send_queued; ++i)
+	  {
+	    BufferAllocated& b = send_queue[i];
+	    send_iov[i].iov_base = b.data();
+	    send_iov[i].iov_len = b.size();
+	  }
+	size_t start = 0;
+	while (start < send_queued)
+	  start = send_messages(start);
+	send_queued = 0;
+      }
+
+      // Send send_queue[start..send_queued) with sendmmsg.  Returns the
+      // index of the first packet not handled, which is less than
+      // send_queued only if GSO failed and must be retried without it.
+      size_t send_messages(const size_t start)
+      {
+	// build one message per packet, or per run of packets with GSO
+	size_t n_msgs = 0;
+	for (size_t i = start; i < send_queued; ++n_msgs)
+	  {
+	    const size_t run = gso ? gso_run(i) : 1;
+	    struct msghdr& mh = send_msgs[n_msgs].msg_hdr;
+	    std::memset(&mh, 0, sizeof(mh));
+	    if (send_endpoint[i].port()) // else use connected peer
+	      {
+		mh.msg_name = send_endpoint[i].data();
+		mh.msg_namelen = send_endpoint[i].size();
+	      }
+	    mh.msg_iov = &send_iov[i];
+	    mh.msg_iovlen = run;
+	    if (run > 1)
+	      {
+		// segment size is the size of the first packet in the run
+		const boost::uint16_t segment = boost::uint16_t(send_queue[i].size());
+		mh.msg_control = send_control[n_msgs].buf;
+		mh.msg_controllen = sizeof(send_control[n_msgs].buf);
+		struct cmsghdr* cm = CMSG_FIRSTHDR(&mh);
+		cm->cmsg_level = SOL_UDP;
+		cm->cmsg_type = UDP_SEGMENT;
+		cm->cmsg_len = CMSG_LEN(sizeof(segment));
+		std::memcpy(CMSG_DATA(cm), &segment, sizeof(segment));
+	      }
+	    send_msgs[n_msgs].msg_len = 0;
+	    send_run[n_msgs] = i;
+	    i += run;
+	  }
+
+	size_t m = 0;
+	while (m < n_msgs)
+	  {
+	    const int status = ::sendmmsg(socket.native_handle(), &send_msgs[m], n_msgs - m, 0);
+	    if (status < 0)
+	      {
+		if (errno == EINTR)
+		  continue;
+		if (errno == EAGAIN || errno == EWOULDBLOCK)
+		  {
+		    // socket buffer is full, block like a synchronous send would
+		    struct pollfd pfd;
+		    pfd.fd = socket.native_handle();
+		    pfd.events = POLLOUT;
+		    pfd.revents = 0;
+		    if (::poll(&pfd, 1, -1) >= 0 || errno == EINTR)
+		      continue;
+		  }
+		if (gso && send_msgs[m].msg_hdr.msg_iovlen > 1)
+		  {
+		    // kernel or device won't segment for us, resend without GSO
+		    OPENVPN_LOG_UDPLINK_ERROR("UDP GSO send error: " << errno << ", disabling GSO");
+		    gso = false;
+		    return send_run[m];
+		  }
+		OPENVPN_LOG_UDPLINK_ERROR("UDP sendmmsg error: " << errno);
+		stats->error(Error::NETWORK_SEND_ERROR);
+		++m; // skip the message that failed
+		continue;
+	      }
+	    for (int j = 0; j < status; ++j, ++m)
+	      {
+		const struct msghdr& mh = send_msgs[m].msg_hdr;
+		size_t expected = 0;
+		for (size_t k = 0; k < mh.msg_iovlen; ++k)
+		  expected += mh.msg_iov[k].iov_len;
+		const size_t wrote = send_msgs[m].msg_len;
+		stats->inc_stat(SessionStats::BYTES_OUT, wrote);
+		stats->inc_stat(SessionStats::PACKETS_OUT, mh.msg_iovlen);
+		if (wrote != expected)
+		  {
+		    OPENVPN_LOG_UDPLINK_ERROR("UDP partial send error");
+		    stats->error(Error::NETWORK_SEND_ERROR);
+		  }
+	      }
+	  }
+	return send_queued;
+      }
+
+      // Length of the run of packets starting at send_queue[i] that can
+      // go out as one GSO message: same destination, same size as the
+      // first packet except for a possibly shorter last packet, and
+      // within the kernel's segment count and datagram size limits.
+      size_t gso_run(const size_t i) const
+      {
+	const size_t segment = send_queue[i].size();
+	size_t total = segment;
+	size_t j = i + 1;
+	while (j < send_queued
+	       && j - i < GSO_MAX_SEGMENTS
+	       && send_endpoint[j] == send_endpoint[i])
+	  {
+	    const size_t size = send_queue[j].size();
+	    if (size > segment || total + size > GSO_MAX_BYTES)
+	      break;
+	    total += size;
+	    ++j;
+	    if (size < segment)
+	      break;
+	  }
+	return j - i;
+      }
+
+      bool probe_gso()
+      {
+	int segment = 0;
+	socklen_t len = sizeof(segment);
+	return ::getsockopt(socket.native_handle(), SOL_UDP, UDP_SEGMENT, &segment, &len) == 0;
+      }
+
+      bool enable_gro()
+      {
+	const int on = 1;
+	if (::setsockopt(socket.native_handle(), SOL_UDP, UDP_GRO, &on, sizeof(on)))
+	  return false;
+	gro_bufs.resize(std::min(batch_size, size_t(GRO_BATCH_SIZE)));
+	gro_control.resize(gro_bufs.size());
+	gro_wait_pending = false;
+	return true;
+      }
+
+      // Wait for the socket to become readable.  Unlike in
+      // queue_read_batch, we need recvmmsg for every read to get at
+      // the UDP_GRO segment size, so the wait is for readiness only.
+      void queue_wait_gro()
+      {
+	gro_wait_pending = true;
+	socket.async_receive(boost::asio::null_buffers(),
+			     asio_dispatch_ready(&Link::handle_ready_gro, this, &arena));
+      }
+
+      void handle_ready_gro(const boost::system::error_code& error)
+      {
+	gro_wait_pending = false;
+	if (!halt)
+	  {
+	    if (error)
+	      {
+		OPENVPN_LOG_UDPLINK_ERROR("UDP recv error: " << error.message());
+		stats->error(Error::NETWORK_RECV_ERROR);
+	      }
+	    drain_gro();
+	  }
+      }
+
+      // Read until the socket is empty.  asio forgets a readiness event
+      // that comes in while no wait is pending, so the wait is re-armed
+      // before the last read to catch anything arriving after that read.
+      void drain_gro()
+      {
+	for (size_t pass = 0; !halt; ++pass)
+	  {
+	    if (recv_gro() == gro_bufs.size())
+	      {
+		if (pass < GRO_MAX_PASSES)
+		  continue;
+
+		// give other handlers a turn, then keep draining
+		io_service.post(asio_dispatch_post(&Link::drain_gro, this));
+		return;
+	      }
+	    if (gro_wait_pending)
+	      return;
+	    queue_wait_gro();
+	  }
+      }
+
+      // read up to gro_bufs.size() datagrams, splitting each into its
+      // UDP_GRO segments, and return the number of datagrams read
+      size_t recv_gro()
+      {
+	const size_t n = gro_bufs.size();
+	for (size_t i = 0; i < n; ++i)
+	  {
+	    BufferAllocated& b = gro_bufs[i];
+	    gro_frame_context.prepare(b);
+	    recv_iov[i].iov_base = b.data();
+	    recv_iov[i].iov_len = gro_frame_context.remaining_payload(b);
+	    struct msghdr& mh = recv_msgs[i].msg_hdr;
+	    std::memset(&mh, 0, sizeof(mh));
+	    mh.msg_name = &recv_addr[i];
+	    mh.msg_namelen = sizeof(recv_addr[i]);
+	    mh.msg_iov = &recv_iov[i];
+	    mh.msg_iovlen = 1;
+	    mh.msg_control = gro_control[i].buf;
+	    mh.msg_controllen = sizeof(gro_control[i].buf);
+	    recv_msgs[i].msg_len = 0;
+	  }
+	const int status = ::recvmmsg(socket.native_handle(), &recv_msgs[0], n, MSG_DONTWAIT, NULL);
+	if (status < 0)
+	  {
+	    if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+	      {
+		OPENVPN_LOG_UDPLINK_ERROR("UDP recvmmsg error: " << errno);
+		stats->error(Error::NETWORK_RECV_ERROR);
+	      }
+	    return 0;
+	  }
+	for (int i = 0; i < status && !halt; ++i)
+	  {
+	    struct msghdr& mh = recv_msgs[i].msg_hdr;
+	    size_t size = recv_msgs[i].msg_len;
+	    if (mh.msg_namelen > recv_pool[0]->sender_endpoint.capacity())
+	      continue;
+
+	    // without a UDP_GRO message, the datagram wasn't coalesced
+	    size_t segment = size;
+	    for (struct cmsghdr* cm = CMSG_FIRSTHDR(&mh); cm; cm = CMSG_NXTHDR(&mh, cm))
+	      {
+		if (cm->cmsg_level == SOL_UDP && cm->cmsg_type == UDP_GRO)
+		  {
+		    int gso_size;
+		    std::memcpy(&gso_size, CMSG_DATA(cm), sizeof(gso_size));
+		    if (gso_size > 0)
+		      segment = gso_size;
+		  }
+	      }
+
+	    // copy each segment into a buffer with the usual headroom
+	    // and tailroom, so that it can be decrypted in place
+	    const unsigned char *data = gro_bufs[i].c_data();
+	    while (size && !halt)
+	      {
+		const size_t len = std::min(size, segment);
+		PacketFrom* udpfrom = recv_pool[0];
+		frame_context.prepare(udpfrom->buf);
+		if (len <= frame_context.remaining_payload(udpfrom->buf))
+		  {
+		    std::memcpy(udpfrom->sender_endpoint.data(), mh.msg_name, mh.msg_namelen);
+		    udpfrom->sender_endpoint.resize(mh.msg_namelen);
+		    udpfrom->buf.write(data, len);
+		    deliver(0, len);
+		  }
+		else
+		  stats->error(Error::BUFFER_ERROR);
+		data += len;
+		size -= len;
+	      }
+	  }
+	return status;
+      }
+#endif
+
+      boost::asio::io_service& io_service;
       boost::asio::ip::udp::socket& socket;
       bool halt;
       ReadHandler read_handler;
       const Frame::Context frame_context;
+      const Frame::Context gro_frame_context;
       SessionStats::Ptr stats;
+      size_t batch_size;
+      bool gso;
+      bool gro;
+      AsioHandlerArena arena;
+
+#ifdef OPENVPN_UDPLINK_MMSG
+      // batched mode only
+      std::vector<PacketFrom*> recv_pool;
+      std::vector<struct mmsghdr> recv_msgs;
+      std::vector<struct iovec> recv_iov;
+      std::vector<struct sockaddr_storage> recv_addr;
+      std::vector<BufferAllocated> send_queue;
+      std::vector<Endpoint> send_endpoint;
+      std::vector<struct mmsghdr> send_msgs;
+      std::vector<struct iovec> send_iov;
+      size_t send_queued;
+      bool flush_pending;
+
+      // segmentation offload
+      enum {
+	GSO_MAX_SEGMENTS = 64,    // kernel limit on segments per GSO send
+	GSO_MAX_BYTES = 65000,    // stay below max UDP datagram size after headers
+	GRO_BATCH_SIZE = 8,       // max coalesced datagrams per recvmmsg
+	GRO_MAX_PASSES = 8,       // max recvmmsg calls per handler before yielding
+      };
+
+      union SegmentControl {
+	char buf[CMSG_SPACE(sizeof(boost::uint16_t))];
+	struct cmsghdr align;
+      };
+
+      union GROControl {
+	char buf[CMSG_SPACE(sizeof(int))];
+	struct cmsghdr align;
+      };
+
+      std::vector<size_t> send_run;  // first packet of each message
+      std::vector<SegmentControl> send_control;
+      std::vector<BufferAllocated> gro_bufs;
+      std::vector<GROControl> gro_control;
+      bool gro_wait_pending;
+#endif
     };
   }
 } // namespace openvpn
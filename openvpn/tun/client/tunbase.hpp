@@ -54,6 +54,15 @@ namespace openvpn {
   struct TunClientParent
   {
     virtual void tun_recv(BufferAllocated& buf) = 0;
+
+    // packets read together in a burst, may be overridden to process
+    // them as a batch
+    virtual void tun_recv_burst(BufferAllocated *const *bufs, const size_t n)
+    {
+      for (size_t i = 0; i < n; ++i)
+	tun_recv(*bufs[i]);
+    }
+
     virtual void tun_error(const Error::Type fatal_err, const std::string& err_text) = 0;
 
     // progress notifications
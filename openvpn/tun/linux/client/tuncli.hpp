@@ -41,6 +41,9 @@ namespace openvpn {
 			Layer layer;
 			int txqueuelen;
 			unsigned int mtu;
+			int n_queues; // tun queues, each beyond the first read by its own thread
+			bool vnet_hdr; // read TSO/GSO packets from tun and segment them ourselves
+			size_t burst_size; // read tun in bursts of up to this many packets, or 0 to disable
 
 			int n_parallel;
 			Frame::Ptr frame;
@@ -55,7 +58,7 @@ namespace openvpn {
 				TunClientParent& parent);
 		private:
 			ClientConfig()
-				: ipv6(false), txqueuelen(200), mtu(1500), n_parallel(8) {}
+				: ipv6(false), txqueuelen(200), mtu(1500), n_queues(1), vnet_hdr(false), burst_size(0), n_parallel(8) {}
 		};
 
 		class Client : public TunClient
@@ -80,9 +83,11 @@ namespace openvpn {
 							config->name,
 							config->ipv6,
 							config->layer,
-							config->txqueuelen
+							config->txqueuelen,
+							config->n_queues,
+							config->vnet_hdr
 							));
-						impl->start(config->n_parallel);
+						impl->start(config->n_parallel, config->burst_size);
 
 						// do ifconfig
 						parent.tun_pre_tun_config();
@@ -153,6 +158,11 @@ namespace openvpn {
 				parent.tun_recv(pfp->buf);
 			}
 
+			void tun_read_burst_handler(BufferAllocated *const *bufs, const size_t n) // called by TunImpl
+			{
+				parent.tun_recv_burst(bufs, n);
+			}
+
 			void stop_()
 			{
 				if (!halt)
@@ -30,8 +30,17 @@
 #include <net/if.h>
 #include <linux/if_tun.h>
 
+#ifndef IFF_MULTI_QUEUE
+#define IFF_MULTI_QUEUE 0x0100 // Linux 3.8+
+#endif
+
 #include <string>
 #include <sstream>
+#include <vector>
+
+#include <boost/atomic.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/lockfree/spsc_queue.hpp>
 
 #include <openvpn/common/process.hpp>
 #include <openvpn/common/format.hpp>
@@ -46,6 +55,196 @@ namespace openvpn {
 			BufferAllocated buf;
 		};
 
+		// A secondary queue of a multi-queue tun device.  Each queue
+		// is read by its own thread running its own io_service, so that
+		// the kernel can spread tun reads across cores by flow.  Packets
+		// are handed back through a single-producer, single-consumer
+		// queue, and passed to the Receiver of the Tun object on its
+		// io_service, so the session state is only ever touched by the
+		// thread that runs the session.  The queue thread posts a drain
+		// only when none is pending, so a burst of reads costs a single
+		// post.  If the session thread falls DELIVER_QUEUE_SIZE packets
+		// behind, the queue thread parks its reads until the next drain,
+		// leaving the kernel to queue (or drop) further packets.  Packets
+		// not yet delivered belong to the TunQueue, and are freed with it.
+		class TunQueue : public RC<thread_safe_refcount>
+		{
+		public:
+			typedef boost::intrusive_ptr<TunQueue> Ptr;
+
+			struct Receiver
+			{
+				virtual void tun_queue_read(PacketFrom::SPtr& pfp) = 0;
+			};
+
+			enum {
+				DELIVER_QUEUE_SIZE = 256, // packets read but not yet delivered
+			};
+
+			TunQueue(boost::asio::io_service& owner_io_service_arg,
+				const int fd,
+				const Frame::Context& frame_context_arg)
+				: owner_io_service(owner_io_service_arg),
+				sd(io_service, fd),
+				frame_context(frame_context_arg),
+				receiver(NULL),
+				thread(NULL),
+				halt(false),
+				deliver_queue(DELIVER_QUEUE_SIZE),
+				drain_pending(false),
+				reader_parked(false)
+			{
+			}
+
+			// called on the owner thread
+			void start(Receiver* receiver_arg, const int n_parallel)
+			{
+				if (!thread)
+				{
+					receiver = receiver_arg;
+					work.reset(new boost::asio::io_service::work(io_service)); // keep running while reads are parked
+					for (int i = 0; i < n_parallel; i++)
+						queue_read(NULL);
+					thread = new boost::thread(&TunQueue::thread_func, this);
+				}
+			}
+
+			// called on the owner thread, waits for the queue thread to exit
+			void stop()
+			{
+				receiver = NULL;
+				if (thread)
+				{
+					io_service.post(asio_dispatch_post(&TunQueue::close, this));
+					thread->join();
+					delete thread;
+					thread = NULL;
+				}
+			}
+
+			~TunQueue()
+			{
+				stop();
+				PacketFrom* tunfrom;
+				while (deliver_queue.pop(tunfrom))
+					delete tunfrom;
+				for (size_t i = 0; i < parked.size(); ++i)
+					delete parked[i];
+			}
+
+		private:
+			void thread_func()
+			{
+				try {
+					io_service.run();
+				}
+				catch (const std::exception& e)
+				{
+					OPENVPN_LOG_TUN_ERROR("TUN queue thread error: " << e.what());
+				}
+			}
+
+			// runs on the queue thread
+			void close()
+			{
+				halt = true;
+				work.reset();
+				boost::system::error_code ec;
+				sd.close(ec);
+			}
+
+			void queue_read(PacketFrom *tunfrom)
+			{
+				if (!tunfrom)
+					tunfrom = new PacketFrom();
+				frame_context.prepare(tunfrom->buf);
+				sd.async_read_some(frame_context.mutable_buffers_1(tunfrom->buf),
+					asio_dispatch_read(&TunQueue::handle_read, this, tunfrom, &arena));
+			}
+
+			// runs on the queue thread
+			void handle_read(PacketFrom *tunfrom, const boost::system::error_code& error, const size_t bytes_recvd)
+			{
+				PacketFrom::SPtr pfp(tunfrom);
+				if (!halt)
+				{
+					if (!error)
+					{
+						pfp->buf.set_size(bytes_recvd);
+						if (!parked.empty() || !deliver_queue.push(pfp.get()))
+						{
+							// deliver_queue is full, so hold the packet
+							// and don't read again until it is drained
+							parked.push_back(pfp.release());
+							reader_parked.store(true, boost::memory_order_seq_cst);
+							post_drain();
+							return;
+						}
+						pfp.release();
+						post_drain();
+					}
+					else
+						OPENVPN_LOG_TUN_ERROR("TUN queue read error: " << error.message());
+					queue_read(pfp.release());
+				}
+			}
+
+			// runs on the queue thread, after the owner thread drained
+			// deliver_queue while reads were parked
+			void resume()
+			{
+				if (halt)
+					return;
+				size_t n = 0;
+				while (n < parked.size() && deliver_queue.push(parked[n]))
+					++n;
+				parked.erase(parked.begin(), parked.begin() + n);
+				if (!parked.empty())
+					reader_parked.store(true, boost::memory_order_seq_cst);
+				post_drain();
+				for (size_t i = 0; i < n; ++i)
+					queue_read(NULL);
+			}
+
+			// runs on the queue thread
+			void post_drain()
+			{
+				if (!drain_pending.exchange(true, boost::memory_order_seq_cst))
+					owner_io_service.post(asio_dispatch_post(&TunQueue::drain, this));
+			}
+
+			// runs on the owner thread, delivers everything queued so far
+			void drain()
+			{
+				drain_pending.store(false, boost::memory_order_seq_cst);
+				PacketFrom* tunfrom;
+				while (deliver_queue.pop(tunfrom))
+				{
+					PacketFrom::SPtr pfp(tunfrom);
+					if (receiver)
+						receiver->tun_queue_read(pfp);
+				}
+				// once stopped, nothing runs io_service, and a posted
+				// resume would hold a reference to this object forever
+				if (receiver && reader_parked.exchange(false, boost::memory_order_seq_cst))
+					io_service.post(asio_dispatch_post(&TunQueue::resume, this));
+			}
+
+			boost::asio::io_service& owner_io_service;
+			boost::asio::io_service io_service;
+			ScopedPtr<boost::asio::io_service::work> work;
+			boost::asio::posix::stream_descriptor sd;
+			const Frame::Context frame_context;
+			Receiver* receiver;
+			boost::thread* thread;
+			bool halt;
+			AsioHandlerArena arena; // only used on the queue thread
+			boost::lockfree::spsc_queue<PacketFrom*> deliver_queue;
+			boost::atomic<bool> drain_pending;   // a drain is posted to the owner thread
+			boost::atomic<bool> reader_parked;   // the owner thread should post a resume
+			std::vector<PacketFrom*> parked;     // read but not yet queued, in order
+		};
+
 		// exceptions
 		OPENVPN_EXCEPTION(tun_open_error);
 		OPENVPN_EXCEPTION(tun_layer_error);
@@ -55,8 +254,13 @@ namespace openvpn {
 		OPENVPN_EXCEPTION(tun_tx_queue_len_error);
 		OPENVPN_EXCEPTION(tun_ifconfig_error);
 
+		// If vnet_hdr is true, the device is opened with IFF_VNET_HDR and
+		// TSO/GSO offload is enabled, so that bulk TCP flows are read as
+		// packets of up to 64 KB and segmented by TunUnixBase.  Only used
+		// for layer 3 devices without packet info (ipv6 false).
+
 		template <typename ReadHandler>
-		class Tun : public TunUnixBase<ReadHandler, PacketFrom>
+		class Tun : public TunUnixBase<ReadHandler, PacketFrom>, private TunQueue::Receiver
 		{
 			typedef TunUnixBase<ReadHandler, PacketFrom> Base;
 
@@ -70,9 +274,15 @@ namespace openvpn {
 				const std::string name,
 				const bool ipv6,
 				const Layer& layer,
-				const int txqueuelen)
-				: Base(read_handler_arg, frame_arg, stats_arg)
+				const int txqueuelen,
+				const int n_queues = 1,
+				const bool vnet_hdr_arg = false)
+				: Base(read_handler_arg, frame_arg, stats_arg,
+					use_vnet_hdr(vnet_hdr_arg, ipv6, layer)),
+				io_service_(io_service)
 			{
+				const bool vnet_hdr = use_vnet_hdr(vnet_hdr_arg, ipv6, layer);
+
 				static const char node[] = "/dev/net/tun";
 				ScopedFD fd(open(node, O_RDWR));
 				if (!fd.defined())
@@ -81,6 +291,10 @@ namespace openvpn {
 				struct ifreq ifr;
 				std::memset(&ifr, 0, sizeof(ifr));
 				ifr.ifr_flags = IFF_ONE_QUEUE;
+				if (n_queues > 1)
+					ifr.ifr_flags |= IFF_MULTI_QUEUE;
+				if (vnet_hdr)
+					ifr.ifr_flags |= IFF_VNET_HDR;
 				if (!ipv6)
 					ifr.ifr_flags |= IFF_NO_PI;
 				if (layer() == Layer::OSI_LAYER_3)
@@ -103,6 +317,17 @@ namespace openvpn {
 				if (fcntl (fd(), F_SETFL, O_NONBLOCK) < 0)
 					throw tun_fcntl_error(errinfo(errno));
 
+				// Let the kernel pass us TSO/GSO packets and packets with
+				// partial checksums.  If it refuses, packets still carry
+				// a virtio_net_hdr, but never need segmenting.
+				if (vnet_hdr)
+				{
+					const unsigned int offload = TUN_F_CSUM|TUN_F_TSO4|TUN_F_TSO6;
+					if (ioctl (fd(), TUNSETOFFLOAD, offload) < 0)
+						OPENVPN_LOG_TUN_ERROR("TUNSETOFFLOAD failed: " << errinfo(errno));
+					Base::vnet_hdr = true;
+				}
+
 				// Set the TX send queue size
 				if (txqueuelen)
 				{
@@ -121,9 +346,49 @@ namespace openvpn {
 						throw tun_tx_queue_len_error(errinfo(errno));
 				}
 
+				// attach the remaining queues of a multi-queue device,
+				// TUNSETIFF now refers to the device created above
+				for (int i = 1; i < n_queues; ++i)
+				{
+					ScopedFD qfd(open(node, O_RDWR));
+					if (!qfd.defined())
+						OPENVPN_THROW(tun_open_error, "error opening tun device " << node << ": " << errinfo(errno));
+					if (ioctl (qfd(), TUNSETIFF, (void *) &ifr) < 0)
+						throw tun_ioctl_error(errinfo(errno));
+					if (fcntl (qfd(), F_SETFL, O_NONBLOCK) < 0)
+						throw tun_fcntl_error(errinfo(errno));
+					queues.push_back(new TunQueue(io_service, qfd.release(), (*frame_arg)[vnet_hdr ? Frame::READ_TUN_VNET : Frame::READ_TUN]));
+				}
+
 				Base::name_ = ifr.ifr_name;
 				Base::sd = new boost::asio::posix::stream_descriptor(io_service, fd.release());
 				OPENVPN_LOG_TUN(Base::name_ << " opened for " << (ipv6 ? "IPv6" : "IPv4"));
+				if (n_queues > 1)
+				{
+					OPENVPN_LOG_TUN(Base::name_ << " has " << n_queues << " queues");
+				}
+			}
+
+			// Packets are always written to the primary queue, while
+			// secondary queues (if any) are read by their own threads.
+			// If burst_size is nonzero, the primary queue is read in
+			// bursts rather than with n_parallel outstanding reads.
+			void start(const int n_parallel, const size_t burst_size = 0)
+			{
+				if (burst_size)
+					Base::start_burst(io_service_, burst_size);
+				else
+					Base::start(n_parallel);
+				for (size_t i = 0; i < queues.size(); ++i)
+					queues[i]->start(this, n_parallel);
+			}
+
+			void stop()
+			{
+				for (size_t i = 0; i < queues.size(); ++i)
+					queues[i]->stop();
+				queues.clear();
+				Base::stop();
 			}
 
 			std::string ifconfig(const OptionList& opt, const unsigned int mtu)
@@ -159,7 +424,22 @@ namespace openvpn {
 				}
 			}
 
-			~Tun() { Base::stop(); }
+			~Tun() { stop(); }
+
+		private:
+			static bool use_vnet_hdr(const bool vnet_hdr, const bool ipv6, const Layer& layer)
+			{
+				return vnet_hdr && !ipv6 && layer() == Layer::OSI_LAYER_3;
+			}
+
+			virtual void tun_queue_read(PacketFrom::SPtr& pfp)
+			{
+				if (!Base::halt)
+					Base::tun_read(pfp);
+			}
+
+			boost::asio::io_service& io_service_;
+			std::vector<TunQueue::Ptr> queues;
 		};
 
 	}
@@ -24,6 +24,11 @@
 #ifndef OPENVPN_TUN_TUNUNIXBASE_H
 #define OPENVPN_TUN_TUNUNIXBASE_H
 
+#include <unistd.h>
+#include <errno.h>
+
+#include <vector>
+
 #include <boost/asio.hpp>
 
 #include <openvpn/common/types.hpp>
@@ -40,6 +45,7 @@
 #include <openvpn/tun/tunspec.hpp>
 #include <openvpn/tun/tunlog.hpp>
 #include <openvpn/tun/layer.hpp>
+#include <openvpn/tun/vnethdr.hpp>
 
 namespace openvpn {
 
@@ -47,17 +53,24 @@ namespace openvpn {
 	class TunUnixBase : public RC<thread_unsafe_refcount>
 	{
 	public:
+		// vnet_hdr_arg must be true if the derived class will set vnet_hdr,
+		// so that reads are sized for TSO/GSO packets
 		TunUnixBase(ReadHandler read_handler_arg,
 			const Frame::Ptr& frame_arg,
-			const SessionStats::Ptr& stats_arg)
+			const SessionStats::Ptr& stats_arg,
+			const bool vnet_hdr_arg = false)
 			: sd(NULL),
 			retain_sd(false),
 			tun_prefix(false),
+			vnet_hdr(false),
 			halt(false),
 			read_handler(read_handler_arg),
 			frame(frame_arg),
-			frame_context((*frame_arg)[Frame::READ_TUN]),
-			stats(stats_arg)
+			frame_context((*frame_arg)[vnet_hdr_arg ? Frame::READ_TUN_VNET : Frame::READ_TUN]),
+			segment_context((*frame_arg)[Frame::READ_TUN]),
+			stats(stats_arg),
+			burst_io_service(NULL),
+			burst_wait_pending(false)
 		{
 		}
 
@@ -93,6 +106,14 @@ namespace openvpn {
 						}
 					}
 
+					// prepend virtio_net_hdr, if enabled
+					if (vnet_hdr && !VnetHdr::prepend_none(buf))
+					{
+						OPENVPN_LOG_TUN_ERROR("TUN write error: cannot write virtio_net_hdr");
+						stats->error(Error::TUN_FRAMING_ERROR);
+						return false;
+					}
+
 					// write data to tun device
 					const size_t wrote = sd->write_some(buf.const_buffers_1());
 					stats->inc_stat(SessionStats::TUN_BYTES_OUT, wrote);
@@ -145,6 +166,12 @@ namespace openvpn {
 			return name_;
 		}
 
+		// allocator for pending reads
+		const AsioHandlerArena& handler_arena() const
+		{
+			return arena;
+		}
+
 	private:
 		void prepend_pf_inet(Buffer& buf, const boost::uint32_t value)
 		{
@@ -162,7 +189,7 @@ namespace openvpn {
 
 			// queue read on tun device
 			sd->async_read_some(frame_context.mutable_buffers_1(tunfrom->buf),
-				asio_dispatch_read(&TunUnixBase::handle_read, this, tunfrom));
+				asio_dispatch_read(&TunUnixBase::handle_read, this, tunfrom, &arena));
 		}
 
 		void handle_read(PacketFrom *tunfrom, const boost::system::error_code& error, const size_t bytes_recvd)
@@ -174,23 +201,7 @@ namespace openvpn {
 				if (!error)
 				{
 					pfp->buf.set_size(bytes_recvd);
-					stats->inc_stat(SessionStats::TUN_BYTES_IN, bytes_recvd);
-					stats->inc_stat(SessionStats::TUN_PACKETS_IN, 1);
-					if (!tun_prefix)
-					{
-						read_handler->tun_read_handler(pfp);
-					}
-					else if (pfp->buf.size() >= 4)
-					{
-						// handle tun packet prefix, if enabled
-						pfp->buf.advance(4);
-						read_handler->tun_read_handler(pfp);
-					}
-					else
-					{
-						OPENVPN_LOG_TUN_ERROR("TUN Read Error: cannot read prefix");
-						stats->error(Error::TUN_READ_ERROR);
-					}
+					tun_read(pfp);
 				}
 				else
 				{
@@ -201,17 +212,217 @@ namespace openvpn {
 			}
 		}
 
+		// account for a packet read from the tun device and pass it to read_handler
+		void tun_read(typename PacketFrom::SPtr& pfp)
+		{
+			stats->inc_stat(SessionStats::TUN_BYTES_IN, pfp->buf.size());
+			stats->inc_stat(SessionStats::TUN_PACKETS_IN, 1);
+			VnetHdr vh;
+			if (!unframe(pfp->buf, vh))
+				return;
+			if (vh.is_gso())
+				tun_read_gso(pfp->buf, vh);
+			else
+				read_handler->tun_read_handler(pfp);
+		}
+
+		// Remove the packet prefix and virtio_net_hdr (if enabled) from a
+		// packet read from the tun device, returning false if the packet
+		// is malformed.  If vh.is_gso() is true on return, buf holds a
+		// GSO packet that must be passed on with tun_read_gso.
+		bool unframe(Buffer& buf, VnetHdr& vh)
+		{
+			vh.gso_type = VnetHdr::GSO_NONE;
+			if (tun_prefix)
+			{
+				if (buf.size() < 4)
+				{
+					OPENVPN_LOG_TUN_ERROR("TUN Read Error: cannot read prefix");
+					stats->error(Error::TUN_READ_ERROR);
+					return false;
+				}
+				buf.advance(4);
+			}
+			if (vnet_hdr)
+			{
+				if (!vh.pop(buf))
+				{
+					OPENVPN_LOG_TUN_ERROR("TUN Read Error: cannot read virtio_net_hdr");
+					stats->error(Error::TUN_FRAMING_ERROR);
+					return false;
+				}
+				if (!vh.is_gso() && !vh.finish_csum(buf))
+				{
+					OPENVPN_LOG_TUN_ERROR("TUN Read Error: bad checksum offset");
+					stats->error(Error::TUN_FRAMING_ERROR);
+					return false;
+				}
+			}
+			return true;
+		}
+
+		// Burst mode: wait for the tun device to become readable, then
+		// read packets until it is empty or burst_size have been read,
+		// and pass them together to read_handler->tun_read_burst_handler.
+		// The packets are read into a ring of buffers allocated here.
+		void start_burst(boost::asio::io_service& io_service, const size_t burst_size)
+		{
+			if (!halt && !burst_ring.defined() && burst_size)
+			{
+				burst_io_service = &io_service;
+				burst_ring.reset(new PacketFrom[burst_size]);
+				burst_bufs.resize(burst_size);
+				burst_wait_pending = false;
+				drain_burst();
+			}
+		}
+
+		void queue_wait_burst()
+		{
+			burst_wait_pending = true;
+			sd->async_read_some(boost::asio::null_buffers(),
+				asio_dispatch_ready(&TunUnixBase::handle_ready_burst, this, &arena));
+		}
+
+		void handle_ready_burst(const boost::system::error_code& error)
+		{
+			burst_wait_pending = false;
+			if (!halt)
+			{
+				if (error)
+				{
+					OPENVPN_LOG_TUN_ERROR("TUN Read Error: " << error.message());
+					stats->error(Error::TUN_READ_ERROR);
+				}
+				drain_burst();
+			}
+		}
+
+		// Read bursts until the device is empty.  asio forgets a readiness
+		// event that comes in while no wait is pending, so the wait is
+		// re-armed before the last read to catch packets arriving after it.
+		void drain_burst()
+		{
+			for (size_t pass = 0; !halt; ++pass)
+			{
+				if (read_burst() == burst_bufs.size())
+				{
+					if (pass < BURST_MAX_PASSES)
+						continue;
+
+					// give other handlers a turn, then keep draining
+					burst_io_service->post(asio_dispatch_post(&TunUnixBase::drain_burst, this));
+					return;
+				}
+				if (burst_wait_pending)
+					return;
+				queue_wait_burst();
+			}
+		}
+
+		// read up to one burst of packets and pass them on, returning
+		// the number of packets read
+		size_t read_burst()
+		{
+			const size_t burst_size = burst_bufs.size();
+			size_t n_read = 0;
+			size_t n = 0;
+			while (n_read < burst_size && !halt)
+			{
+				BufferAllocated& buf = burst_ring.get()[n].buf;
+				frame_context.prepare(buf);
+				const ssize_t status = ::read(sd->native_handle(), buf.data(), frame_context.remaining_payload(buf));
+				if (status <= 0)
+				{
+					if (status < 0 && errno == EINTR)
+						continue;
+					if (status == 0 || (errno != EAGAIN && errno != EWOULDBLOCK))
+					{
+						OPENVPN_LOG_TUN_ERROR("TUN Read Error: " << (status ? errno : 0));
+						stats->error(Error::TUN_READ_ERROR);
+					}
+					break;
+				}
+				++n_read;
+				buf.set_size(status);
+				stats->inc_stat(SessionStats::TUN_BYTES_IN, status);
+				stats->inc_stat(SessionStats::TUN_PACKETS_IN, 1);
+				VnetHdr vh;
+				if (!unframe(buf, vh))
+					continue;
+				if (vh.is_gso())
+				{
+					// pass on what we have first, to keep packets in order
+					deliver_burst(n);
+					n = 0;
+					tun_read_gso(buf, vh);
+					continue;
+				}
+				burst_bufs[n++] = &buf;
+			}
+			deliver_burst(n);
+			return n_read;
+		}
+
+		void deliver_burst(const size_t n)
+		{
+			if (n && !halt)
+				read_handler->tun_read_burst_handler(&burst_bufs[0], n);
+		}
+
+		// Split a TSO/GSO packet into MTU-sized packets, each passed to
+		// read_handler in a buffer of its own with the usual headroom
+		// for encryption.
+		void tun_read_gso(const Buffer& buf, const VnetHdr& vh)
+		{
+			VnetHdr::Segmenter seg;
+			if (!seg.init(buf, vh) || seg.max_segment_size() > segment_context.payload())
+			{
+				OPENVPN_LOG_TUN_ERROR("TUN Read Error: bad GSO packet");
+				stats->error(Error::TUN_FRAMING_ERROR);
+				return;
+			}
+			size_t n = 0;
+			while (!halt)
+			{
+				if (!segfrom.defined())
+					segfrom.reset(new PacketFrom());
+				segment_context.prepare(segfrom->buf);
+				if (!seg.next(segfrom->buf))
+					break;
+				read_handler->tun_read_handler(segfrom);
+				++n;
+			}
+			if (n > 1)
+				stats->inc_stat(SessionStats::TUN_PACKETS_IN, n - 1);
+		}
+
+		enum {
+			BURST_MAX_PASSES = 8, // max bursts per handler before yielding
+		};
+
 		// should be set by derived class constructor
 		std::string name_;
 		boost::asio::posix::stream_descriptor *sd;
 		bool retain_sd;  // don't close tun socket
 		bool tun_prefix;
+		bool vnet_hdr;   // packets are preceded by virtio_net_hdr
 
 		bool halt;
 		ReadHandler read_handler;
 		const Frame::Ptr frame;
 		const Frame::Context& frame_context;
+		const Frame::Context& segment_context;
 		SessionStats::Ptr stats;
+		typename PacketFrom::SPtr segfrom; // reused for GSO segments
+
+		// burst mode
+		boost::asio::io_service* burst_io_service;
+		ScopedPtr<PacketFrom, PtrArrayFree> burst_ring;
+		std::vector<BufferAllocated*> burst_bufs;
+		bool burst_wait_pending;
+
+		AsioHandlerArena arena;
 	};
 }
 
@@ -0,0 +1,269 @@
+//    OpenVPN -- An application to securely tunnel IP networks
+//               over a single port, with support for SSL/TLS-based
+//               session authentication and key exchange,
+//               packet encryption, packet authentication, and
+//               packet compression.
+//
+//    Copyright (C) 2013 OpenVPN Technologies, Inc.
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Affero General Public License Version 3
+//    as published by the Free Software Foundation.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Affero General Public License for more details.
+//
+//    You should have received a copy of the GNU Affero General Public License
+//    along with this program in the COPYING file.
+//    If not, see <http://www.gnu.org/licenses/>.
+
+// Handle the virtio_net_hdr that precedes each packet on a tun device
+// opened with IFF_VNET_HDR, including segmentation of TSO/GSO packets
+// and completion of partial checksums that the kernel leaves to us.
+
+#ifndef OPENVPN_TUN_VNETHDR_H
+#define OPENVPN_TUN_VNETHDR_H
+
+#include <cstring>
+#include <algorithm>
+
+#include <boost/cstdint.hpp>
+
+#include <openvpn/buffer/buffer.hpp>
+#include <openvpn/ip/ip.hpp>
+#include <openvpn/ip/csum.hpp>
+
+namespace openvpn {
+  class VnetHdr
+  {
+  public:
+    enum {
+      SIZE = 10, // sizeof(struct virtio_net_hdr)
+    };
+
+    // flags
+    enum {
+      F_NEEDS_CSUM = 1,
+    };
+
+    // gso_type
+    enum {
+      GSO_NONE = 0,
+      GSO_TCPV4 = 1,
+      GSO_UDP = 3,
+      GSO_TCPV6 = 4,
+      GSO_ECN = 0x80,
+    };
+
+    // virtio_net_hdr fields, in host byte order
+    unsigned int flags;
+    unsigned int gso_type;
+    size_t hdr_len;
+    size_t gso_size;
+    size_t csum_start;
+    size_t csum_offset;
+
+    // Remove the header from the front of buf, returning false if buf
+    // is too short.
+    bool pop(Buffer& buf)
+    {
+      if (buf.size() < SIZE)
+	return false;
+      const unsigned char *p = buf.read_alloc(SIZE);
+      flags = p[0];
+      gso_type = p[1];
+      hdr_len = host16(p + 2);
+      gso_size = host16(p + 4);
+      csum_start = host16(p + 6);
+      csum_offset = host16(p + 8);
+      return true;
+    }
+
+    bool is_gso() const
+    {
+      return (gso_type & ~GSO_ECN) != GSO_NONE;
+    }
+
+    // Prepend an all-zero header to buf (no GSO, checksums complete),
+    // returning false if buf lacks the headroom.
+    static bool prepend_none(Buffer& buf)
+    {
+      if (buf.offset() < SIZE)
+	return false;
+      const unsigned char hdr[SIZE] = { 0 };
+      buf.prepend(hdr, SIZE);
+      return true;
+    }
+
+    // If the kernel left the transport checksum for us to complete,
+    // do so.  The checksum field already holds the pseudo-header sum.
+    bool finish_csum(Buffer& buf) const
+    {
+      if (flags & F_NEEDS_CSUM)
+	{
+	  if (csum_start + csum_offset + 2 > buf.size())
+	    return false;
+	  unsigned char *data = buf.data();
+	  const boost::uint16_t csum = IPChecksum::checksum(data + csum_start, buf.size() - csum_start);
+	  IPChecksum::store(data + csum_start + csum_offset, csum);
+	}
+      return true;
+    }
+
+    // Split a TCP TSO/GSO packet into segments of at most gso_size
+    // payload bytes, each with its own copy of the IP and TCP headers,
+    // fixed up with the lengths, sequence number, flags and checksums
+    // that the NIC would have produced.
+    class Segmenter
+    {
+    public:
+      // buf is the packet following the header, and must outlive us
+      bool init(const Buffer& buf, const VnetHdr& vh)
+      {
+	pkt = buf.c_data();
+	pkt_size = buf.size();
+	mss = vh.gso_size;
+	offset = 0;
+	index = 0;
+	if (!mss || !pkt_size)
+	  return false;
+
+	// find headers ourselves rather than trusting hdr_len
+	const unsigned int ver = IPHeader::version(pkt[0]);
+	switch (vh.gso_type & ~GSO_ECN)
+	  {
+	  case GSO_TCPV4:
+	    if (ver != 4 || pkt_size < sizeof(IPHeader))
+	      return false;
+	    ip_hdr_len = IPHeader::length(pkt[0]);
+	    if (ip_hdr_len < sizeof(IPHeader) || pkt[9] != IPHeader::TCP)
+	      return false;
+	    break;
+	  case GSO_TCPV6:
+	    // extension headers are not supported
+	    if (ver != 6 || pkt_size < IPV6_HDR_LEN || pkt[6] != IPHeader::TCP)
+	      return false;
+	    ip_hdr_len = IPV6_HDR_LEN;
+	    break;
+	  default:
+	    return false;
+	  }
+	if (pkt_size < ip_hdr_len + TCP_HDR_LEN)
+	  return false;
+	hdr_len = ip_hdr_len + ((pkt[ip_hdr_len + 12] >> 4) << 2);
+	if (hdr_len < ip_hdr_len + TCP_HDR_LEN || hdr_len >= pkt_size)
+	  return false;
+	payload_size = pkt_size - hdr_len;
+	return true;
+      }
+
+      // upper bound on size of each segment
+      size_t max_segment_size() const
+      {
+	return hdr_len + mss;
+      }
+
+      // Write the next segment to seg, which must be empty and have
+      // room for max_segment_size() bytes.  Returns false when there
+      // are no more segments.
+      bool next(Buffer& seg)
+      {
+	if (offset >= payload_size)
+	  return false;
+	const size_t len = std::min(mss, payload_size - offset);
+	const bool last = (offset + len == payload_size);
+	seg.write(pkt, hdr_len);
+	seg.write(pkt + hdr_len + offset, len);
+	unsigned char *ip = seg.data();
+	unsigned char *tcp = ip + ip_hdr_len;
+	const size_t tcp_len = hdr_len - ip_hdr_len + len;
+
+	// IP header
+	boost::uint32_t sum;
+	if (ip_hdr_len == IPV6_HDR_LEN)
+	  {
+	    put16(ip + 4, tcp_len);
+	    sum = IPChecksum::add(0, ip + 8, 32); // saddr, daddr
+	  }
+	else
+	  {
+	    put16(ip + 2, hdr_len + len);
+	    put16(ip + 4, get16(ip + 4) + index);
+	    put16(ip + 10, 0);
+	    IPChecksum::store(ip + 10, IPChecksum::checksum(ip, ip_hdr_len));
+	    sum = IPChecksum::add(0, ip + 12, 8); // saddr, daddr
+	  }
+	sum += IPHeader::TCP + tcp_len;
+
+	// TCP header, FIN and PSH only on the last segment, CWR only on the first
+	put32(tcp + 4, get32(tcp + 4) + boost::uint32_t(offset));
+	if (!last)
+	  tcp[13] &= ~(TCP_FIN|TCP_PSH);
+	if (index)
+	  tcp[13] &= ~TCP_CWR;
+	put16(tcp + 16, 0);
+	IPChecksum::store(tcp + 16, IPChecksum::finish(IPChecksum::add(sum, tcp, tcp_len)));
+
+	offset += len;
+	++index;
+	return true;
+      }
+
+    private:
+      enum {
+	IPV6_HDR_LEN = 40,
+	TCP_HDR_LEN = 20,
+	TCP_FIN = 0x01,
+	TCP_PSH = 0x08,
+	TCP_CWR = 0x80,
+      };
+
+      const unsigned char *pkt;
+      size_t pkt_size;
+      size_t mss;
+      size_t ip_hdr_len;
+      size_t hdr_len;
+      size_t payload_size;
+      size_t offset;
+      unsigned int index;
+    };
+
+  private:
+    // virtio_net_hdr is in host byte order
+    static size_t host16(const unsigned char *p)
+    {
+      boost::uint16_t v;
+      std::memcpy(&v, p, sizeof(v));
+      return v;
+    }
+
+    // IP and TCP headers are in network byte order
+    static size_t get16(const unsigned char *p)
+    {
+      return (size_t(p[0]) << 8) | p[1];
+    }
+
+    static boost::uint32_t get32(const unsigned char *p)
+    {
+      return (boost::uint32_t(p[0]) << 24) | (boost::uint32_t(p[1]) << 16) | (boost::uint32_t(p[2]) << 8) | p[3];
+    }
+
+    static void put16(unsigned char *p, const size_t v)
+    {
+      p[0] = (unsigned char)(v >> 8);
+      p[1] = (unsigned char)(v & 0xFF);
+    }
+
+    static void put32(unsigned char *p, const boost::uint32_t v)
+    {
+      p[0] = (unsigned char)(v >> 24);
+      p[1] = (unsigned char)((v >> 16) & 0xFF);
+      p[2] = (unsigned char)((v >> 8) & 0xFF);
+      p[3] = (unsigned char)(v & 0xFF);
+    }
+  };
+} // namespace openvpn
+
+#endif // OPENVPN_TUN_VNETHDR_H
@@ -0,0 +1,161 @@
+//    OpenVPN -- An application to securely tunnel IP networks
+//               over a single port, with support for SSL/TLS-based
+//               session authentication and key exchange,
+//               packet encryption, packet authentication, and
+//               packet compression.
+//
+//    Copyright (C) 2013 OpenVPN Technologies, Inc.
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Affero General Public License Version 3
+//    as published by the Free Software Foundation.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Affero General Public License for more details.
+//
+//    You should have received a copy of the GNU Affero General Public License
+//    along with this program in the COPYING file.
+//    If not, see <http://www.gnu.org/licenses/>.
+
+
+
+// Unit test for the Asio handler arena (class AsioHandlerArena)
+
+#include <iostream>
+#include <string>
+
+#define OPENVPN_DEBUG
+#define OPENVPN_ENABLE_ASSERT
+
+#include <boost/asio.hpp>
+
+#include <openvpn/log/logsimple.hpp>
+
+#include <openvpn/common/types.hpp>
+#include <openvpn/common/exception.hpp>
+#include <openvpn/common/rc.hpp>
+#include <openvpn/common/asioarena.hpp>
+#include <openvpn/common/asiodispatch.hpp>
+
+using namespace openvpn;
+
+OPENVPN_EXCEPTION(asioarena_test_failed);
+
+static void check(const bool cond, const std::string& what)
+{
+  if (!cond)
+    throw asioarena_test_failed(what);
+}
+
+// Bounces a datagram back and forth between two connected UDP sockets,
+// with every receive and send allocated from one arena, for a given
+// number of round trips.
+class PingPong : public RC<thread_unsafe_refcount>
+{
+public:
+  typedef boost::intrusive_ptr<PingPong> Ptr;
+
+  PingPong(boost::asio::io_service& io_service)
+    : a(io_service),
+      b(io_service),
+      remaining(0),
+      allocs_after_first(0)
+  {
+    const boost::asio::ip::udp::endpoint any(boost::asio::ip::address_v4::loopback(), 0);
+    a.open(boost::asio::ip::udp::v4());
+    b.open(boost::asio::ip::udp::v4());
+    a.bind(any);
+    b.bind(any);
+    a.connect(b.local_endpoint());
+    b.connect(a.local_endpoint());
+  }
+
+  void start(const unsigned int round_trips)
+  {
+    remaining = round_trips;
+    queue_read(&b);
+    send(&a);
+  }
+
+  void close()
+  {
+    a.close();
+    b.close();
+  }
+
+  AsioHandlerArena arena;
+  count_t allocs_after_first; // arena heap allocations after the first round trip
+
+private:
+  void queue_read(boost::asio::ip::udp::socket* s)
+  {
+    s->async_receive(boost::asio::buffer(buf, sizeof(buf)),
+		     asio_dispatch_read(&PingPong::handle_read, this, s, &arena));
+  }
+
+  void send(boost::asio::ip::udp::socket* s)
+  {
+    s->async_send(boost::asio::buffer(buf, 1),
+		  asio_dispatch_write(&PingPong::handle_write, this, &arena));
+  }
+
+  void handle_read(boost::asio::ip::udp::socket* s, const boost::system::error_code& error, const size_t bytes)
+  {
+    check(!error && bytes == 1, "receive failed");
+    boost::asio::ip::udp::socket* peer = (s == &a) ? &b : &a;
+    if (s == &a)
+      {
+	if (!allocs_after_first)
+	  allocs_after_first = arena.heap_allocs();
+	if (!--remaining)
+	  {
+	    close();
+	    return;
+	  }
+      }
+    queue_read(peer);
+    send(s);
+  }
+
+  void handle_write(const boost::system::error_code& error, const size_t bytes)
+  {
+    check(!error && bytes == 1, "send failed");
+  }
+
+  boost::asio::ip::udp::socket a;
+  boost::asio::ip::udp::socket b;
+  unsigned int remaining;
+  unsigned char buf[16];
+};
+
+// Once the arena has a slot for every operation pending at once, more
+// operations don't allocate from the heap.
+static void test_heap_allocs_flat()
+{
+  enum { ROUND_TRIPS = 10000 };
+  boost::asio::io_service io_service;
+  PingPong::Ptr pp(new PingPong(io_service));
+  pp->start(ROUND_TRIPS);
+  io_service.run();
+
+  const count_t allocs = pp->arena.heap_allocs();
+  check(pp->allocs_after_first > 0, "operations not allocated from the arena");
+  check(allocs == pp->allocs_after_first, "arena heap allocations grew with the number of operations");
+  check(!pp->arena.n_oversize(), "operation too large for an arena slot");
+}
+
+int main(int /*argc*/, char* /*argv*/[])
+{
+  try {
+    test_heap_allocs_flat();
+  }
+  catch (const std::exception& e)
+    {
+      std::cerr << "FAILED: " << e.what() << std::endl;
+      return 1;
+    }
+  std::cerr << "OK" << std::endl;
+  return 0;
+}
@@ -0,0 +1,201 @@
+//    OpenVPN -- An application to securely tunnel IP networks
+//               over a single port, with support for SSL/TLS-based
+//               session authentication and key exchange,
+//               packet encryption, packet authentication, and
+//               packet compression.
+//
+//    Copyright (C) 2013 OpenVPN Technologies, Inc.
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Affero General Public License Version 3
+//    as published by the Free Software Foundation.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Affero General Public License for more details.
+//
+//    You should have received a copy of the GNU Affero General Public License
+//    along with this program in the COPYING file.
+//    If not, see <http://www.gnu.org/licenses/>.
+
+
+// Unit test for the UDP replay window (class PacketIDReceive)
+
+#include <iostream>
+#include <string>
+
+#define OPENVPN_DEBUG
+#define OPENVPN_ENABLE_ASSERT
+
+#include <openvpn/log/logsimple.hpp>
+
+#include <openvpn/common/exception.hpp>
+#include <openvpn/log/sessionstats.hpp>
+#include <openvpn/crypto/packet_id.hpp>
+
+using namespace openvpn;
+
+OPENVPN_EXCEPTION(packet_id_test_failed);
+
+class MySessionStats : public SessionStats
+{
+public:
+  typedef boost::intrusive_ptr<MySessionStats> Ptr;
+
+  virtual void error(const size_t err_type, const std::string* text=NULL)
+  {
+    count_error(err_type);
+  }
+};
+
+// replay window with seq_backtrack=64 and time_backtrack=30
+class ReplayWindow
+{
+public:
+  enum {
+    SEQ_BACKTRACK = 64,
+    TIME_BACKTRACK = 30,
+  };
+
+  ReplayWindow()
+    : stats(new MySessionStats)
+  {
+    pr.init(PacketIDReceive::UDP_MODE, PacketID::SHORT_FORM,
+	    SEQ_BACKTRACK, TIME_BACKTRACK, "TEST", 0, stats);
+  }
+
+  // run a received packet ID through test and, if accepted, add
+  bool recv(const PacketID::time_t pin_time, const PacketID::id_t pin_id, const PacketID::time_t now)
+  {
+    const PacketIDConstruct pin(pin_time, pin_id);
+    if (!pr.test(pin, now))
+      return false;
+    pr.add(pin, now);
+    return true;
+  }
+
+  count_t errors(const Error::Type type) const
+  {
+    return stats->get_error(type);
+  }
+
+private:
+  MySessionStats::Ptr stats;
+  PacketIDReceive pr;
+};
+
+static const PacketID::time_t T = 1000; // pin.time of the sender
+
+static void check(const bool cond, const std::string& what)
+{
+  if (!cond)
+    throw packet_id_test_failed(what);
+}
+
+static void test_in_order()
+{
+  ReplayWindow w;
+  for (PacketID::id_t id = 1; id <= 1000; ++id)
+    check(w.recv(T, id, T), "in-order packet rejected");
+}
+
+static void test_duplicate()
+{
+  ReplayWindow w;
+  for (PacketID::id_t id = 1; id <= 100; ++id)
+    w.recv(T, id, T);
+  check(!w.recv(T, 100, T), "duplicate of newest packet accepted");
+  check(!w.recv(T, 50, T), "duplicate of older packet accepted");
+  check(w.errors(Error::PKTID_UDP_REPLAY) == 2, "replays not counted");
+}
+
+static void test_reorder()
+{
+  ReplayWindow w;
+  for (PacketID::id_t id = 1; id <= 200; ++id)
+    if (id != 150 && id != 136)
+      w.recv(T, id, T);
+
+  // within seq_backtrack: 200-150 < 64
+  check(w.recv(T, 150, T), "reordered packet within window rejected");
+  check(!w.recv(T, 150, T), "reordered packet accepted twice");
+
+  // beyond seq_backtrack: 200-136 == 64
+  check(!w.recv(T, 136, T), "reordered packet beyond window accepted");
+  check(w.errors(Error::PKTID_UDP_LARGE_DIFF) == 1, "large diff not counted");
+}
+
+static void test_jump()
+{
+  ReplayWindow w;
+  for (PacketID::id_t id = 1; id <= 200; ++id)
+    w.recv(T, id, T);
+
+  // jump far past the window
+  check(w.recv(T, 10000, T), "jump past window rejected");
+  check(!w.recv(T, 200, T), "packet from before the jump accepted");
+
+  // 9995 shares a window bit with 139, which was seen before the
+  // jump, and must not be mistaken for a replay
+  check(w.recv(T, 9995, T), "packet after jump rejected by stale window bit");
+  check(!w.recv(T, 9995, T), "packet after jump accepted twice");
+}
+
+static void test_time_backtrack()
+{
+  ReplayWindow w;
+  const PacketID::time_t t0 = T;
+  const PacketID::time_t t1 = T + 20;
+
+  // 1..10 (except 3 and 5) arrive at t0, 11..20 (except 15) at t1
+  for (PacketID::id_t id = 1; id <= 10; ++id)
+    if (id != 3 && id != 5)
+      w.recv(T, id, t0);
+  for (PacketID::id_t id = 11; id <= 20; ++id)
+    if (id != 15)
+      w.recv(T, id, t1);
+
+  // 5 is still within time_backtrack of t0
+  check(w.recv(T, 5, t0 + ReplayWindow::TIME_BACKTRACK), "late packet within time backtrack rejected");
+
+  // once time_backtrack has passed since t0, nothing at or below
+  // the highest ID seen at t0 is accepted, but 15 still is
+  check(!w.recv(T, 3, t0 + ReplayWindow::TIME_BACKTRACK + 1), "packet older than time backtrack accepted");
+  check(w.recv(T, 15, t0 + ReplayWindow::TIME_BACKTRACK + 1), "late packet within time backtrack of t1 rejected");
+}
+
+static void test_pin_time_change()
+{
+  ReplayWindow w;
+  for (PacketID::id_t id = 1; id <= 100; ++id)
+    w.recv(T, id, T);
+
+  // sender restarted its sequence with a later time
+  check(w.recv(T + 5, 1, T + 5), "packet with newer pin.time rejected");
+  check(!w.recv(T + 5, 1, T + 5), "packet with newer pin.time accepted twice");
+  check(w.recv(T + 5, 2, T + 5), "in-order packet after pin.time change rejected");
+
+  // the old time stamp is now a time backtrack
+  check(!w.recv(T, 101, T + 5), "packet with older pin.time accepted");
+  check(w.errors(Error::PKTID_UDP_TIME_BACKTRACK) == 1, "time backtrack not counted");
+}
+
+int main(int /*argc*/, char* /*argv*/[])
+{
+  try {
+    test_in_order();
+    test_duplicate();
+    test_reorder();
+    test_jump();
+    test_time_backtrack();
+    test_pin_time_change();
+  }
+  catch (const std::exception& e)
+    {
+      std::cerr << "FAILED: " << e.what() << std::endl;
+      return 1;
+    }
+  std::cerr << "OK" << std::endl;
+  return 0;
+}
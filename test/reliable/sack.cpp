@@ -0,0 +1,267 @@
+//    OpenVPN -- An application to securely tunnel IP networks
+//               over a single port, with support for SSL/TLS-based
+//               session authentication and key exchange,
+//               packet encryption, packet authentication, and
+//               packet compression.
+//
+//    Copyright (C) 2013 OpenVPN Technologies, Inc.
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Affero General Public License Version 3
+//    as published by the Free Software Foundation.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Affero General Public License for more details.
+//
+//    You should have received a copy of the GNU Affero General Public License
+//    along with this program in the COPYING file.
+//    If not, see <http://www.gnu.org/licenses/>.
+
+
+
+// Unit test for cumulative+selective ACKs (SACKs) and retransmit
+// deadlines in the reliability layer
+
+#include <iostream>
+#include <string>
+#include <vector>
+
+#define OPENVPN_DEBUG
+#define OPENVPN_ENABLE_ASSERT
+
+#include <openvpn/log/logsimple.hpp>
+
+#include <openvpn/common/exception.hpp>
+#include <openvpn/buffer/buffer.hpp>
+#include <openvpn/time/time.hpp>
+#include <openvpn/reliable/relsend.hpp>
+#include <openvpn/reliable/relrecv.hpp>
+#include <openvpn/reliable/relack.hpp>
+
+using namespace openvpn;
+
+OPENVPN_EXCEPTION(sack_test_failed);
+
+typedef ReliableSendTemplate<BufferPtr> ReliableSend;
+typedef ReliableRecvTemplate<BufferPtr> ReliableRecv;
+typedef ReliableAck::id_t id_t;
+
+static void check(const bool cond, const std::string& what)
+{
+  if (!cond)
+    throw sack_test_failed(what);
+}
+
+// buffer with room to prepend an ACK field
+static BufferPtr ack_buffer()
+{
+  BufferPtr buf(new BufferAllocated(256, 0));
+  buf->init_headroom(128);
+  return buf;
+}
+
+// receive ids on a fresh receive window of the given span, passing
+// in-sequence messages up as they become ready
+static void receive(ReliableRecv& rr, ReliableAck& xmit_acks, const id_t *ids, const size_t n)
+{
+  for (size_t i = 0; i < n; ++i)
+    {
+      rr.receive(BufferPtr(new BufferAllocated()), ids[i]);
+      xmit_acks.push_back(ids[i]);
+      while (rr.ready())
+	rr.advance();
+    }
+}
+
+// queue n messages on rs, one every 10ms
+static void send(ReliableSend& rs, const size_t n, Time& now)
+{
+  for (size_t i = 0; i < n; ++i)
+    {
+      ReliableSend::Message& m = rs.send(now);
+      m.packet.reset(new BufferAllocated());
+      now += Time::Duration::binary_ms(10);
+    }
+}
+
+static void test_sack_roundtrip()
+{
+  static const id_t got[] = { 0, 1, 3, 5, 6 };
+  ReliableRecv rr(8);
+  ReliableAck xmit_acks(4);
+  receive(rr, xmit_acks, got, sizeof(got)/sizeof(got[0]));
+  check(rr.head_id() == 2, "receive window head not at first missing id");
+  check(rr.received_bitmap() == 0x1a, "receive bitmap does not match ids 3, 5, 6");
+
+  BufferPtr buf = ack_buffer();
+  xmit_acks.prepend_sack(*buf, rr.head_id(), rr.received_bitmap());
+  check(xmit_acks.empty(), "pending ACKs not cleared by SACK");
+  check(buf->size() == 1 + 4 + 8, "SACK has wrong length");
+  check((*buf)[0] == ReliableAck::SACK_FLAG, "SACK flag not set");
+
+  // read back as the selectively ACKed ids
+  {
+    Buffer b(*buf);
+    ReliableAck rd(0);
+    check(rd.read(b) == 1, "SACK not counted as one ACK");
+    check(b.empty(), "SACK not fully read");
+    static const id_t expect[] = { 3, 5, 6 };
+    for (size_t i = 0; i < sizeof(expect)/sizeof(expect[0]); ++i)
+      {
+	check(!rd.empty() && rd.front() == expect[i], "SACK read back wrong id");
+	rd.pop_front();
+      }
+    check(rd.empty(), "SACK read back extra ids");
+  }
+
+  // skipped whole
+  {
+    Buffer b(*buf);
+    check(ReliableAck::ack_skip(b) == 1, "skipped SACK not counted as one ACK");
+    check(b.empty(), "SACK not fully skipped");
+  }
+
+  // both halves of the bitmap, and an id with every byte significant
+  {
+    BufferPtr b = ack_buffer();
+    ReliableAck sa(0);
+    const id_t head = 0x12345678;
+    sa.prepend_sack(*b, head, (boost::uint64_t(1) << 63) | (boost::uint64_t(1) << 32) | 1);
+    ReliableAck rd(0);
+    rd.read(*b);
+    check(rd.size() == 3, "SACK bitmap halves not read back");
+    check(rd.front() == head, "SACK head id corrupted");
+    rd.pop_front();
+    check(rd.front() == head + 32, "SACK bitmap low half corrupted");
+    rd.pop_front();
+    check(rd.front() == head + 63, "SACK bitmap high half corrupted");
+  }
+
+  // an ACK list is still read as before
+  {
+    BufferPtr b = ack_buffer();
+    ReliableAck la(4);
+    la.push_back(7);
+    la.push_back(9);
+    la.prepend(*b);
+    ReliableAck rd(0);
+    check(rd.read(*b) == 2, "ACK list not read");
+    check(rd.front() == 7, "ACK list read back wrong id");
+  }
+}
+
+static void test_sack_retire()
+{
+  Time now = Time::now();
+  ReliableSend rs(8);
+  send(rs, 8, now);
+  check(rs.n_unacked() == 8, "messages not queued");
+
+  // peer has everything before 2, and 3, 5, 6
+  BufferPtr buf = ack_buffer();
+  ReliableAck sa(0);
+  sa.prepend_sack(*buf, 2, 0x1a);
+  check(ReliableAck::ack(rs, *buf, true, now) == 1, "SACK not counted as one ACK");
+  check(rs.head_id() == 2, "send window not advanced to first unACKed id");
+  check(rs.n_unacked() == 3, "SACKed messages not retired");
+  check(rs.ref_by_id(2).packet && rs.ref_by_id(4).packet && rs.ref_by_id(7).packet,
+	"unACKed message retired");
+
+  // only the holes are retransmitted
+  now += Time::Duration::seconds(10);
+  std::vector<id_t> due;
+  ReliableSend::Message* m;
+  while ((m = rs.next_due(now)))
+    {
+      due.push_back(m->id());
+      rs.reset_retransmit(*m, now);
+    }
+  check(due.size() == 3 && due[0] == 2 && due[1] == 4 && due[2] == 7,
+	"retransmitted messages other than the unACKed ones");
+
+  // not live: parsed, but nothing retired
+  buf = ack_buffer();
+  sa.prepend_sack(*buf, 8, 0);
+  check(ReliableAck::ack(rs, *buf, false, now) == 1, "SACK not parsed");
+  check(rs.n_unacked() == 3, "SACK retired messages when not live");
+}
+
+// A SACK comes from the peer, and must not retire anything beyond
+// what has been sent.
+static void test_sack_bounds()
+{
+  Time now = Time::now();
+  ReliableSend rs(8);
+  send(rs, 4, now);
+
+  BufferPtr buf = ack_buffer();
+  ReliableAck sa(0);
+  sa.prepend_sack(*buf, 1000, ~boost::uint64_t(0));
+  ReliableAck::ack(rs, *buf, true, now);
+  check(rs.n_unacked() == 0, "sent messages not retired by SACK");
+  check(rs.head_id() == 4, "send window advanced past what was sent");
+  check(rs.ready(), "send window not ready after SACK");
+
+  send(rs, 1, now);
+  check(rs.n_unacked() == 1 && rs.ref_by_id(4).packet, "send after SACK not queued");
+}
+
+// After a message has backed off, a clean RTT sample resets the
+// backoff, and messages sent after that are due at their own RTO, not
+// behind the backed-off message.
+static void test_deadline_order()
+{
+  Time now = Time::now();
+  ReliableSend rs(8);
+  send(rs, 1, now);
+
+  // message 0 is lost, and backs off
+  for (int i = 0; i < 5; ++i)
+    {
+      now += rs.until_retransmit(now);
+      ReliableSend::Message* m = rs.next_due(now);
+      check(m && m->id() == 0, "lost message not due for retransmit");
+      rs.reset_retransmit(*m, now);
+    }
+  const Time backed_off_at = now + rs.ref_by_id(0).until_retransmit(now);
+
+  // message 1 is ACKed, having been sent once, which resets the backoff
+  send(rs, 1, now);
+  rs.ack(1, now);
+  const Time::Duration rto = rs.rto().rto();
+  check(now + rto < backed_off_at, "backoff not reset by a clean ACK");
+
+  // message 2 is due at its own RTO, ahead of message 0
+  send(rs, 1, now);
+  check(rs.until_retransmit(now) < rto + Time::Duration::binary_ms(1),
+	"new message not due at its own RTO");
+  now += rto;
+  ReliableSend::Message* m = rs.next_due(now);
+  check(m && m->id() == 2, "new message queued behind backed-off message");
+  rs.ack(2, now);
+
+  // message 0 is still due when it was
+  check(!rs.next_due(now), "backed-off message due early");
+  now = backed_off_at;
+  m = rs.next_due(now);
+  check(m && m->id() == 0, "backed-off message not due at its deadline");
+}
+
+int main(int /*argc*/, char* /*argv*/[])
+{
+  try {
+    test_sack_roundtrip();
+    test_sack_retire();
+    test_sack_bounds();
+    test_deadline_order();
+  }
+  catch (const std::exception& e)
+    {
+      std::cerr << "FAILED: " << e.what() << std::endl;
+      return 1;
+    }
+  std::cerr << "OK" << std::endl;
+  return 0;
+}
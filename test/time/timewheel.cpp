@@ -0,0 +1,296 @@
+//    OpenVPN -- An application to securely tunnel IP networks
+//               over a single port, with support for SSL/TLS-based
+//               session authentication and key exchange,
+//               packet encryption, packet authentication, and
+//               packet compression.
+//
+//    Copyright (C) 2013 OpenVPN Technologies, Inc.
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Affero General Public License Version 3
+//    as published by the Free Software Foundation.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Affero General Public License for more details.
+//
+//    You should have received a copy of the GNU Affero General Public License
+//    along with this program in the COPYING file.
+//    If not, see <http://www.gnu.org/licenses/>.
+
+
+
+// Unit test for the hashed timing wheel (class TimingWheel)
+
+#include <iostream>
+#include <string>
+#include <vector>
+
+#define OPENVPN_DEBUG
+#define OPENVPN_ENABLE_ASSERT
+
+#include <openvpn/log/logsimple.hpp>
+
+#include <openvpn/common/exception.hpp>
+#include <openvpn/time/time.hpp>
+#include <openvpn/time/timewheel.hpp>
+
+using namespace openvpn;
+
+OPENVPN_EXCEPTION(timewheel_test_failed);
+
+static const Time::Duration TICK = Time::Duration::binary_ms(1 << TimingWheel::TICK_SHIFT);
+
+// n revolutions of the wheel
+static Time::Duration revolutions(const unsigned int n)
+{
+  return Time::Duration::binary_ms((n * TimingWheel::N_SLOTS) << TimingWheel::TICK_SHIFT);
+}
+
+static Time now; // time of the current advance()
+
+static void check(const bool cond, const std::string& what)
+{
+  if (!cond)
+    throw timewheel_test_failed(what);
+}
+
+// Timer that records when it fired, and can act on the wheel from
+// timer_expired()
+class TestTimer : public TimingWheel::Timer
+{
+public:
+  TestTimer()
+    : n_fired(0),
+      wheel(NULL),
+      cancel_other(NULL),
+      delete_self(false),
+      deleted(NULL)
+  {
+  }
+
+  virtual ~TestTimer()
+  {
+    if (deleted)
+      ++*deleted;
+  }
+
+  Time fired_at;
+  unsigned int n_fired;
+  bool early;               // fired before expiry at least once
+  Time::Duration max_late;  // longest time after expiry that it fired
+
+  TimingWheel* wheel;
+  TestTimer* cancel_other;  // cancel this timer when fired
+  std::vector<Time> rearm;  // re-arm at each of these in turn when fired
+  bool delete_self;         // delete this when fired
+  int* deleted;             // incremented by destructor
+
+private:
+  virtual void timer_expired()
+  {
+    check(!armed(), "timer still armed in timer_expired");
+    if (!n_fired)
+      early = false;
+    if (now < expiry())
+      early = true;
+    else if (now - expiry() > max_late)
+      max_late = now - expiry();
+    fired_at = now;
+    ++n_fired;
+
+    if (cancel_other)
+      cancel_other->cancel();
+    if (!rearm.empty())
+      {
+	wheel->arm(*this, rearm.front());
+	rearm.erase(rearm.begin());
+      }
+    if (delete_self)
+      delete this;
+  }
+};
+
+// advance the wheel from now to end in steps
+static void run(TimingWheel& w, const Time& end, const Time::Duration& step)
+{
+  while (now < end)
+    {
+      now += step;
+      w.advance(now);
+    }
+}
+
+// a wheel whose current tick is now
+static TimingWheel::Ptr new_wheel()
+{
+  TimingWheel::Ptr w(new TimingWheel());
+  now = Time::now();
+  w->advance(now);
+  return w;
+}
+
+// check that t fired, never early, and within a tick of expiry, given
+// that the wheel was advanced in steps of up to step
+static void check_on_time(const TestTimer& t, const Time::Duration& step, const std::string& what)
+{
+  check(t.n_fired > 0, what + ": not fired");
+  check(!t.early, what + ": fired early");
+  check(t.max_late < TICK + step, what + ": fired a tick or more late");
+}
+
+// Timers at arbitrary times, some unaligned to a tick and some
+// several revolutions out, fire once, never early and within a tick.
+static void test_never_early()
+{
+  enum { N = 200 };
+  TimingWheel::Ptr w = new_wheel();
+  const Time start = now;
+  TestTimer timers[N];
+  for (size_t i = 0; i < N; ++i)
+    w->arm(timers[i], start + Time::Duration::binary_ms((i * 997) % 60000 + i));
+  check(w->size() == N, "armed timers not counted");
+
+  run(*w, start + Time::Duration::binary_ms(70000), Time::Duration::binary_ms(5));
+  check(w->empty(), "timers still armed after the last expiry");
+  for (size_t i = 0; i < N; ++i)
+    {
+      check_on_time(timers[i], Time::Duration::binary_ms(5), "timer at arbitrary time");
+      check(timers[i].n_fired == 1, "timer fired more than once");
+    }
+}
+
+// A timer N revolutions out is visited N times while its rounds count
+// down, and fires on the visit after that, neither a revolution early
+// nor late.
+static void test_multi_revolution()
+{
+  for (unsigned int n = 1; n <= 4; ++n)
+    {
+      TimingWheel::Ptr w = new_wheel();
+      TestTimer t;
+      w->arm(t, now + revolutions(n) + Time::Duration::binary_ms(100));
+
+      unsigned int visits = 0;
+      while (!t.n_fired && visits <= n + 1)
+	{
+	  now = w->next_visit();
+	  w->advance(now);
+	  ++visits;
+	}
+      check(visits == n + 1, "multi-revolution timer fired on the wrong revolution");
+      check_on_time(t, Time::Duration(), "multi-revolution timer");
+    }
+}
+
+// Timers may cancel, re-arm or destroy timers, themselves included,
+// from timer_expired().
+static void test_expired_callback()
+{
+  TimingWheel::Ptr w = new_wheel();
+  const Time start = now;
+
+  // a and b expire together, and each cancels the other, so whichever
+  // fires first cancels the one still waiting to fire
+  TestTimer a, b;
+  a.cancel_other = &b;
+  b.cancel_other = &a;
+  w->arm(a, start + Time::Duration::seconds(1));
+  w->arm(b, start + Time::Duration::seconds(1));
+
+  // c re-arms itself, as a periodic timer
+  TestTimer c;
+  c.wheel = w.get();
+  for (int i = 2; i <= 4; ++i)
+    c.rearm.push_back(start + Time::Duration::seconds(i));
+  w->arm(c, start + Time::Duration::seconds(1));
+
+  // d re-arms itself for a time already past, which fires on the next
+  // tick rather than from inside advance()
+  TestTimer d;
+  d.wheel = w.get();
+  d.rearm.push_back(start);
+  w->arm(d, start + Time::Duration::seconds(1));
+
+  // e destroys itself
+  int deleted = 0;
+  TestTimer* e = new TestTimer();
+  e->delete_self = true;
+  e->deleted = &deleted;
+  w->arm(*e, start + Time::Duration::seconds(1));
+
+  run(*w, start + Time::Duration::seconds(1) + TICK, TICK);
+  check(a.n_fired + b.n_fired == 1, "timer cancelled by another fired anyway");
+  check(!a.armed() && !b.armed(), "cancelled timer still armed");
+  check(c.n_fired == 1 && c.armed(), "periodic timer not re-armed");
+  check(deleted == 1, "timer not destroyed from timer_expired");
+  check(d.n_fired == 1 || (d.n_fired == 2 && d.fired_at > start + Time::Duration::seconds(1)),
+	"timer re-armed in the past fired from inside advance");
+
+  run(*w, start + Time::Duration::seconds(5), Time::Duration::binary_ms(16));
+  check(d.n_fired == 2, "timer re-armed in the past did not fire");
+  check(c.n_fired == 4, "periodic timer did not fire every period");
+  check_on_time(c, Time::Duration::binary_ms(16), "periodic timer");
+  check(w->empty(), "timers still armed");
+}
+
+// next_visit() is the first tick at which advance() would find a timer
+// in its slot: never before the earliest expiry of a timer due this
+// revolution, and within a tick of it.
+static void test_next_visit()
+{
+  TimingWheel::Ptr w = new_wheel();
+  const Time start = now;
+  check(w->next_visit().is_infinite(), "next visit of empty wheel not infinite");
+
+  TestTimer a, b, c;
+  w->arm(a, start + Time::Duration::binary_ms(1000));
+  Time v = w->next_visit();
+  check(v >= a.expiry() && v < a.expiry() + TICK, "next visit not at timer expiry");
+
+  // an earlier timer brings the visit forward, and cancelling it
+  // moves it back
+  w->arm(b, start + Time::Duration::binary_ms(500));
+  v = w->next_visit();
+  check(v >= b.expiry() && v < b.expiry() + TICK, "next visit not at earliest expiry");
+  b.cancel();
+  check(w->next_visit() >= a.expiry() && w->next_visit() < a.expiry() + TICK,
+	"next visit not moved back after cancel");
+
+  // a timer several revolutions out is visited once a revolution
+  w->arm(c, start + revolutions(2) + Time::Duration::binary_ms(300));
+  a.cancel();
+  v = w->next_visit();
+  check(v > start && v <= start + revolutions(1), "next visit of distant timer not this revolution");
+  now = v;
+  w->advance(now);
+  check(!c.n_fired && c.armed(), "distant timer fired on first visit");
+  check(w->next_visit() == v + revolutions(1), "next visit of distant timer not a revolution later");
+
+  // advancing to just before the visit changes nothing
+  const Time v2 = w->next_visit();
+  now += (v2 - now) - Time::Duration::binary_ms(1);
+  w->advance(now);
+  check(w->next_visit() == v2, "next visit changed by advancing short of it");
+
+  c.cancel();
+  check(w->next_visit().is_infinite(), "next visit of emptied wheel not infinite");
+}
+
+int main(int /*argc*/, char* /*argv*/[])
+{
+  try {
+    test_never_early();
+    test_multi_revolution();
+    test_expired_callback();
+    test_next_visit();
+  }
+  catch (const std::exception& e)
+    {
+      std::cerr << "FAILED: " << e.what() << std::endl;
+      return 1;
+    }
+  std::cerr << "OK" << std::endl;
+  return 0;
+}